@@ -251,6 +251,40 @@ int GetDeviceSDKVersion() {
     return jnSDK;
 }
 
+bool BHasPermission(const std::string &sPermission) {
+    SETUP_FOR_JAVA_CALL
+
+    jclass cActivity = env->GetObjectClass(gApp->activity->clazz);
+    jmethodID mCheckSelfPermission = env->GetMethodID(cActivity, "checkSelfPermission", "(Ljava/lang/String;)I");
+
+    jstring jsPermission = env->NewStringUTF(sPermission.c_str());
+    jint nResult = env->CallIntMethod(gApp->activity->clazz, mCheckSelfPermission, jsPermission);
+    env->DeleteLocalRef(jsPermission);
+
+    //PackageManager.PERMISSION_GRANTED
+    return nResult == 0;
+}
+
+void RequestPermission(const std::string &sPermission) {
+    //the prompt is an activity of its own, so it has to be started from the UI thread
+    gApp->uiThreadCallbackHandler->post([sPermission]() {
+        SETUP_FOR_JAVA_CALL
+
+        jclass cActivity = env->GetObjectClass(gApp->activity->clazz);
+        jmethodID mRequestPermissions = env->GetMethodID(cActivity, "requestPermissions", "([Ljava/lang/String;I)V");
+
+        jobjectArray jvPermissions = env->NewObjectArray(1, env->FindClass("java/lang/String"), nullptr);
+        env->SetObjectArrayElement(jvPermissions, 0, env->NewStringUTF(sPermission.c_str()));
+
+        //nothing receives the result, callers poll BHasPermission instead
+        env->CallVoidMethod(gApp->activity->clazz, mRequestPermissions, jvPermissions, (jint) 0);
+        if (env->ExceptionCheck()) {
+            Log(LogError, "[Android] Failed to request permission %s", sPermission.c_str());
+            env->ExceptionClear();
+        }
+    });
+}
+
 TraceRAII::TraceRAII(const std::string &sTraceName) {
     ATrace_beginSection(sTraceName.c_str());
 }
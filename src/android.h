@@ -68,6 +68,11 @@ void DumpObjectClassProperties( jobject objToDump );
 
 int GetDeviceSDKVersion();
 
+bool BHasPermission( const std::string &sPermission );
+
+// Shows the system prompt for a runtime permission, the outcome is only visible through BHasPermission
+void RequestPermission( const std::string &sPermission );
+
 std::string GetDeviceManufacturerRaw();
 EDeviceManufacturer GetDeviceManufacturer();
 
@@ -21,10 +21,16 @@
 #include <poll.h>
 #include <pthread.h>
 #include <sched.h>
+#include <sys/eventfd.h>
+#include <array>
+#include <atomic>
+#include <cstddef>
 #include <functional>
+#include <new>
 #include <unistd.h>
 
 #include <android/configuration.h>
+#include <android/log.h>
 #include <android/looper.h>
 #include <android/native_activity.h>
 
@@ -99,6 +105,10 @@ struct android_poll_source
 	void (*process)( struct android_app *app, struct android_poll_source *source );
 };
 
+// Runs tasks posted from any thread on the thread that attached it.
+// Tasks live inline in a preallocated bounded MPSC ring, so posting never allocates. The looper fd is only
+// signalled when the ring goes from drained to non-empty, and a task posted with a key is dropped while an
+// earlier task with the same key is still waiting to run.
 class UIThreadCallbackHandler
 {
 public:
@@ -107,11 +117,43 @@ public:
 		return new UIThreadCallbackHandler;
 	}
 
+	// Keys identify a kind of task for an owner, e.g. drawing a specific webview. pOwner must be at least
+	// 16 byte aligned, which heap allocations are.
+	static uint64_t MakeTaskKey( const void *pOwner, uint32_t unTag )
+	{
+		return (uint64_t) (uintptr_t) pOwner | ( unTag & 0xf );
+	}
+
 	template<typename FUNC, typename... ARGS>
 	bool post( FUNC &&func, ARGS &&... args )
 	{
-		auto callable = new Callable( func, std::forward<ARGS>( args )... );
-		write( m_fdPipe[ 1 ], &callable, sizeof( decltype( callable )));
+		return postWithKey( 0, std::forward<FUNC>( func ), std::forward<ARGS>( args )... );
+	}
+
+	// Returns true if the task is queued or an identical task is already waiting to run.
+	template<typename FUNC, typename... ARGS>
+	bool postCoalesced( uint64_t ulKey, FUNC &&func, ARGS &&... args )
+	{
+		std::atomic<uint64_t> &pendingKey = m_aPendingKeys[ GetPendingKeySlot( ulKey ) ];
+
+		uint64_t ulExpected = 0;
+		if ( !pendingKey.compare_exchange_strong( ulExpected, ulKey, std::memory_order_acq_rel ))
+		{
+			if ( ulExpected == ulKey )
+			{
+				return true;
+			}
+
+			//slot is taken by another key, queue without deduplicating
+			return postWithKey( 0, std::forward<FUNC>( func ), std::forward<ARGS>( args )... );
+		}
+
+		if ( !postWithKey( ulKey, std::forward<FUNC>( func ), std::forward<ARGS>( args )... ))
+		{
+			pendingKey.store( 0, std::memory_order_release );
+			return false;
+		}
+
 		return true;
 	}
 
@@ -125,74 +167,183 @@ public:
 
 	virtual ~UIThreadCallbackHandler()
 	{
-		ALooper_removeFd( m_pLooper, m_fdPipe[ 0 ] );
+		ALooper_removeFd( m_pLooper, m_fdEvent );
 		ALooper_release( m_pLooper );
-		close( m_fdPipe[ 0 ] );
-		close( m_fdPipe[ 1 ] );
+		close( m_fdEvent );
+
+		//tasks that never ran still own their captures
+		Task *pTask;
+		while (( pTask = BeginDequeue()) != nullptr )
+		{
+			pTask->pfnDestroy( pTask->storage );
+			EndDequeue();
+		}
 	}
 
 private:
-	class Callable
+	static constexpr uint32_t k_unTaskCount = 256;
+	static constexpr uint32_t k_unTaskStorageBytes = 64;
+	static constexpr uint32_t k_unPendingKeySlots = 64;
+
+	struct Task
 	{
-	public:
-		void call()
+		std::atomic<uint32_t> unSequence;
+		uint64_t ulKey;
+		void ( *pfnInvoke )( void *pStorage );
+		void ( *pfnDestroy )( void *pStorage );
+		alignas( std::max_align_t ) unsigned char storage[k_unTaskStorageBytes];
+	};
+
+	static uint32_t GetPendingKeySlot( uint64_t ulKey )
+	{
+		return (uint32_t) (( ulKey >> 4 ) ^ ( ulKey >> 12 )) % k_unPendingKeySlots;
+	}
+
+	template<typename FUNC, typename... ARGS>
+	bool postWithKey( uint64_t ulKey, FUNC &&func, ARGS &&... args )
+	{
+		auto callable = [ func = std::forward<FUNC>( func ), ... args = std::forward<ARGS>( args ) ]() mutable
 		{
-			if ( m_function )
+			std::invoke( func, args... );
+		};
+		using Callable = decltype( callable );
+		static_assert( sizeof( Callable ) <= k_unTaskStorageBytes, "UI thread task captures too much to be stored inline" );
+		static_assert( alignof( Callable ) <= alignof( std::max_align_t ));
+
+		//Vyukov bounded queue: a task is free for the producer that claims position n when its sequence is n
+		uint32_t unPosition = m_unEnqueuePosition.load( std::memory_order_relaxed );
+		Task *pTask;
+		for ( ;; )
+		{
+			pTask = &m_aTasks[ unPosition % k_unTaskCount ];
+			const uint32_t unSequence = pTask->unSequence.load( std::memory_order_acquire );
+			const int32_t nDiff = (int32_t) ( unSequence - unPosition );
+			if ( nDiff == 0 )
 			{
-				m_function();
+				if ( m_unEnqueuePosition.compare_exchange_weak( unPosition, unPosition + 1, std::memory_order_relaxed ))
+				{
+					break;
+				}
+			}
+			else if ( nDiff < 0 )
+			{
+				__android_log_print( ANDROID_LOG_ERROR, "NativeActivity", "[AppGlue] UI thread task queue is full, dropping task" );
+				return false;
+			}
+			else
+			{
+				unPosition = m_unEnqueuePosition.load( std::memory_order_relaxed );
 			}
 		}
 
-		template<typename FUNC, typename... ARGS>
-		Callable( FUNC func, ARGS... args ) : m_function( std::bind( func, args... ))
-		{
-		}
-
-		Callable() = delete;
-
-		Callable( const Callable & ) = delete;
+		new( pTask->storage ) Callable( std::move( callable ));
+		pTask->pfnInvoke = []( void *pStorage ) { ( *(Callable *) pStorage )(); };
+		pTask->pfnDestroy = []( void *pStorage ) { ( (Callable *) pStorage )->~Callable(); };
+		pTask->ulKey = ulKey;
+		pTask->unSequence.store( unPosition + 1, std::memory_order_release );
 
-		Callable( Callable && ) = delete;
+		//pairs with the fence in LooperCallback: publishing the task and reading the flag are a store followed by a
+		//load of different variables, which only a full fence on both sides keeps in order. either the consumer sees
+		//the task or this sees the flag cleared and signals
+		std::atomic_thread_fence( std::memory_order_seq_cst );
 
-		Callable
-		operator=( const Callable & ) = delete;
+		//only the first post after the consumer went idle needs to wake it up
+		if ( !m_bSignalled.exchange( true, std::memory_order_acq_rel ))
+		{
+			uint64_t ulOne = 1;
+			write( m_fdEvent, &ulOne, sizeof( ulOne ));
+		}
 
-		Callable operator=( Callable && ) = delete;
+		return true;
+	}
 
-		virtual ~Callable()
+	// Consumer side, returns nullptr if the ring is empty or the next task is still being written.
+	Task *BeginDequeue()
+	{
+		Task *pTask = &m_aTasks[ m_unDequeuePosition % k_unTaskCount ];
+		if ( pTask->unSequence.load( std::memory_order_acquire ) != m_unDequeuePosition + 1 )
 		{
+			return nullptr;
 		}
 
-	private:
-		std::function<void()> m_function;
-	};
+		return pTask;
+	}
+
+	void EndDequeue()
+	{
+		m_aTasks[ m_unDequeuePosition % k_unTaskCount ].unSequence.store( m_unDequeuePosition + k_unTaskCount, std::memory_order_release );
+		m_unDequeuePosition++;
+	}
 
 	UIThreadCallbackHandler()
 	{
-		if ( pipe( m_fdPipe ) != 0 )
+		for ( uint32_t i = 0; i < k_unTaskCount; i++ )
+		{
+			m_aTasks[ i ].unSequence.store( i, std::memory_order_relaxed );
+		}
+
+		m_fdEvent = eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK );
+		if ( m_fdEvent == -1 )
 		{
 			throw std::bad_alloc();
 		}
 		m_pLooper = ALooper_forThread();
 		ALooper_acquire( m_pLooper );
-		if ( ALooper_addFd( m_pLooper, m_fdPipe[ 0 ], ALOOPER_POLL_CALLBACK,
-							ALOOPER_EVENT_INPUT, LooperCallback, nullptr ) == -1 )
+		if ( ALooper_addFd( m_pLooper, m_fdEvent, ALOOPER_POLL_CALLBACK,
+							ALOOPER_EVENT_INPUT, LooperCallback, this ) == -1 )
 		{
 			throw std::bad_alloc();
 		}
 	};
 
 	ALooper *m_pLooper;
-	int m_fdPipe[2];
+	int m_fdEvent;
+
+	std::array<Task, k_unTaskCount> m_aTasks;
+	alignas( 64 ) std::atomic<uint32_t> m_unEnqueuePosition = 0;
+	alignas( 64 ) uint32_t m_unDequeuePosition = 0;
+	std::atomic<bool> m_bSignalled = false;
+
+	std::array<std::atomic<uint64_t>, k_unPendingKeySlots> m_aPendingKeys{};
 
 	static int LooperCallback( int fd, int events, void *data )
 	{
-		char *pBuffer = new char[sizeof( Callable * )];
-		read( fd, (void *) pBuffer, sizeof( Callable * ));
-		Callable *pCallable = *((Callable **) pBuffer);
-		pCallable->call();
-		delete[] pBuffer;
-		delete pCallable;
+		UIThreadCallbackHandler *pHandler = (UIThreadCallbackHandler *) data;
+
+		uint64_t ulCount;
+		read( fd, &ulCount, sizeof( ulCount ));
+
+		//cleared before draining, so anything posted from here on either gets drained below or signals again.
+		//the fence pairs with the one in postWithKey, so the clear can't be ordered after the first dequeue
+		pHandler->m_bSignalled.store( false, std::memory_order_relaxed );
+		std::atomic_thread_fence( std::memory_order_seq_cst );
+
+		//bounded so tasks that keep posting themselves can't starve the rest of the looper
+		for ( uint32_t i = 0; i < k_unTaskCount; i++ )
+		{
+			Task *pTask = pHandler->BeginDequeue();
+			if ( !pTask )
+			{
+				return 1;
+			}
+
+			//a task with the same key posted from now on has to run again
+			if ( pTask->ulKey != 0 )
+			{
+				pHandler->m_aPendingKeys[ GetPendingKeySlot( pTask->ulKey ) ].store( 0, std::memory_order_release );
+			}
+
+			pTask->pfnInvoke( pTask->storage );
+			pTask->pfnDestroy( pTask->storage );
+			pHandler->EndDequeue();
+		}
+
+		if ( !pHandler->m_bSignalled.exchange( true, std::memory_order_acq_rel ))
+		{
+			uint64_t ulOne = 1;
+			write( pHandler->m_fdEvent, &ulOne, sizeof( ulOne ));
+		}
+
 		return 1;
 	}
 };
@@ -0,0 +1,88 @@
+#include "binaryframes.h"
+
+#include <cstring>
+
+BinaryFrameReader::BinaryFrameReader( const uint8_t *pBuffer, size_t unBufferBytes )
+		: m_pBuffer( pBuffer ), m_unBufferBytes( unBufferBytes )
+{
+}
+
+bool BinaryFrameReader::Next( BinaryFrame &outFrame )
+{
+	if ( m_unOffset == m_unBufferBytes )
+	{
+		return false;
+	}
+
+	if ( m_unBufferBytes - m_unOffset < sizeof( BinaryFrameHeader ))
+	{
+		m_bTruncated = true;
+		return false;
+	}
+
+	//the payload after a header has no alignment guarantees, so never read the header in place
+	BinaryFrameHeader header;
+	memcpy( &header, m_pBuffer + m_unOffset, sizeof( header ));
+
+	const size_t unPayloadOffset = m_unOffset + sizeof( BinaryFrameHeader );
+	if ( m_unBufferBytes - unPayloadOffset < header.unLength )
+	{
+		m_bTruncated = true;
+		return false;
+	}
+
+	outFrame.usType = header.usType;
+	outFrame.unSequence = header.unSequence;
+	outFrame.pData = m_pBuffer + unPayloadOffset;
+	outFrame.unLength = header.unLength;
+
+	m_unOffset = unPayloadOffset + header.unLength;
+	return true;
+}
+
+void AppendBinaryFrame( std::vector<uint8_t> &vBuffer, uint16_t usType, uint32_t unSequence, const void *pData, uint32_t unLength )
+{
+	const BinaryFrameHeader header = {
+			.usType = usType,
+			.usReserved = 0,
+			.unSequence = unSequence,
+			.unLength = unLength,
+	};
+
+	const size_t unOffset = vBuffer.size();
+	vBuffer.resize( unOffset + sizeof( header ) + unLength );
+	memcpy( vBuffer.data() + unOffset, &header, sizeof( header ));
+	if ( unLength > 0 )
+	{
+		memcpy( vBuffer.data() + unOffset + sizeof( header ), pData, unLength );
+	}
+}
+
+void AppendBase64( std::string &sOut, const uint8_t *pData, size_t unLength )
+{
+	static const char k_rgchAlphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+	const size_t unOffset = sOut.size();
+	sOut.resize( unOffset + ( unLength + 2 ) / 3 * 4 );
+	char *pOut = sOut.data() + unOffset;
+
+	size_t i = 0;
+	for ( ; i + 3 <= unLength; i += 3 )
+	{
+		const uint32_t unBits = ( pData[ i ] << 16 ) | ( pData[ i + 1 ] << 8 ) | pData[ i + 2 ];
+		*pOut++ = k_rgchAlphabet[ ( unBits >> 18 ) & 63 ];
+		*pOut++ = k_rgchAlphabet[ ( unBits >> 12 ) & 63 ];
+		*pOut++ = k_rgchAlphabet[ ( unBits >> 6 ) & 63 ];
+		*pOut++ = k_rgchAlphabet[ unBits & 63 ];
+	}
+
+	if ( i < unLength )
+	{
+		const bool bTwoBytes = i + 1 < unLength;
+		const uint32_t unBits = ( pData[ i ] << 16 ) | ( bTwoBytes ? pData[ i + 1 ] << 8 : 0 );
+		*pOut++ = k_rgchAlphabet[ ( unBits >> 18 ) & 63 ];
+		*pOut++ = k_rgchAlphabet[ ( unBits >> 12 ) & 63 ];
+		*pOut++ = bTwoBytes ? k_rgchAlphabet[ ( unBits >> 6 ) & 63 ] : '=';
+		*pOut++ = '=';
+	}
+}
\ No newline at end of file
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Binary messages between the page and native code are a run of frames, each one a 12 byte little endian header
+// followed by its payload:
+//   uint16 type, uint16 reserved (0), uint32 sequence, uint32 payload length
+// The sequence is counted per type by the sender so the receiver can spot dropped frames.
+struct BinaryFrameHeader
+{
+	uint16_t usType;
+	uint16_t usReserved;
+	uint32_t unSequence;
+	uint32_t unLength;
+};
+
+static_assert( sizeof( BinaryFrameHeader ) == 12, "binary frame header must match the layout the page writes" );
+
+// A frame pointing into the buffer it was read from.
+struct BinaryFrame
+{
+	uint16_t usType = 0;
+	uint32_t unSequence = 0;
+	const uint8_t *pData = nullptr;
+	uint32_t unLength = 0;
+};
+
+// Walks the frames of a buffer without copying it.
+class BinaryFrameReader
+{
+public:
+	BinaryFrameReader( const uint8_t *pBuffer, size_t unBufferBytes );
+
+	// Returns false once the buffer is used up or the next frame runs past its end.
+	bool Next( BinaryFrame &outFrame );
+
+	// Set if the buffer ended in the middle of a frame.
+	bool BIsTruncated() const
+	{
+		return m_bTruncated;
+	}
+
+private:
+	const uint8_t *m_pBuffer;
+	size_t m_unBufferBytes;
+	size_t m_unOffset = 0;
+	bool m_bTruncated = false;
+};
+
+void AppendBinaryFrame( std::vector<uint8_t> &vBuffer, uint16_t usType, uint32_t unSequence, const void *pData, uint32_t unLength );
+
+// Standard base64 with padding, for carrying frames over a string-only channel.
+void AppendBase64( std::string &sOut, const uint8_t *pData, size_t unLength );
\ No newline at end of file
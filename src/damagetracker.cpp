@@ -0,0 +1,176 @@
+#include "damagetracker.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined( __ARM_NEON )
+#include <arm_neon.h>
+#endif
+
+static bool BRowDiffers( const uint8_t *pA, const uint8_t *pB, size_t unBytes )
+{
+#if defined( __ARM_NEON )
+	size_t i = 0;
+	uint8x16_t acc = vdupq_n_u8( 0 );
+	for ( ; i + 64 <= unBytes; i += 64 )
+	{
+		acc = vorrq_u8( acc, veorq_u8( vld1q_u8( pA + i ), vld1q_u8( pB + i )));
+		acc = vorrq_u8( acc, veorq_u8( vld1q_u8( pA + i + 16 ), vld1q_u8( pB + i + 16 )));
+		acc = vorrq_u8( acc, veorq_u8( vld1q_u8( pA + i + 32 ), vld1q_u8( pB + i + 32 )));
+		acc = vorrq_u8( acc, veorq_u8( vld1q_u8( pA + i + 48 ), vld1q_u8( pB + i + 48 )));
+	}
+	for ( ; i + 16 <= unBytes; i += 16 )
+	{
+		acc = vorrq_u8( acc, veorq_u8( vld1q_u8( pA + i ), vld1q_u8( pB + i )));
+	}
+
+	if ( vmaxvq_u8( acc ) != 0 )
+	{
+		return true;
+	}
+
+	return i < unBytes && memcmp( pA + i, pB + i, unBytes - i ) != 0;
+#else
+	return memcmp( pA, pB, unBytes ) != 0;
+#endif
+}
+
+DamageTracker::DamageTracker( uint32_t unWidth, uint32_t unHeight, uint32_t unTileSize )
+		: m_unWidth( unWidth ), m_unHeight( unHeight ), m_unTileSize( unTileSize )
+{
+	m_unTilesX = ( m_unWidth + m_unTileSize - 1 ) / m_unTileSize;
+	m_unTilesY = ( m_unHeight + m_unTileSize - 1 ) / m_unTileSize;
+
+	m_vShadowFrame.resize( m_unWidth * m_unHeight * 4 );
+
+	m_vPendingTiles.resize( m_unTilesX * m_unTilesY );
+	m_vPublishedTiles.resize( m_unTilesX * m_unTilesY );
+
+	//nothing has been published yet, so the first frame needs to go up in full
+	MarkAllDirty();
+}
+
+PixelRect DamageTracker::GetTileRect( uint32_t unTileX, uint32_t unTileY ) const
+{
+	PixelRect rect;
+	rect.nX = (int32_t) ( unTileX * m_unTileSize );
+	rect.nY = (int32_t) ( unTileY * m_unTileSize );
+	rect.nWidth = (int32_t) std::min( m_unTileSize, m_unWidth - rect.nX );
+	rect.nHeight = (int32_t) std::min( m_unTileSize, m_unHeight - rect.nY );
+
+	return rect;
+}
+
+bool DamageTracker::BTileDiffers( const uint8_t *pPixels, uint32_t unStrideBytes, uint32_t unTileX, uint32_t unTileY ) const
+{
+	PixelRect rect = GetTileRect( unTileX, unTileY );
+
+	const uint32_t unShadowStride = GetShadowStrideBytes();
+	for ( int32_t nRow = rect.nY; nRow < rect.nY + rect.nHeight; nRow++ )
+	{
+		if ( BRowDiffers( pPixels + nRow * unStrideBytes + rect.nX * 4,
+						  m_vShadowFrame.data() + nRow * unShadowStride + rect.nX * 4,
+						  rect.nWidth * 4 ))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void DamageTracker::CopyTileToShadow( const uint8_t *pPixels, uint32_t unStrideBytes, uint32_t unTileX, uint32_t unTileY )
+{
+	PixelRect rect = GetTileRect( unTileX, unTileY );
+
+	const uint32_t unShadowStride = GetShadowStrideBytes();
+	for ( int32_t nRow = rect.nY; nRow < rect.nY + rect.nHeight; nRow++ )
+	{
+		memcpy( m_vShadowFrame.data() + nRow * unShadowStride + rect.nX * 4,
+				pPixels + nRow * unStrideBytes + rect.nX * 4,
+				rect.nWidth * 4 );
+	}
+}
+
+bool DamageTracker::Update( const uint8_t *pPixels, uint32_t unStrideBytes )
+{
+	bool bAnyPending = false;
+	for ( uint32_t unTileY = 0; unTileY < m_unTilesY; unTileY++ )
+	{
+		for ( uint32_t unTileX = 0; unTileX < m_unTilesX; unTileX++ )
+		{
+			const uint32_t unTile = unTileY * m_unTilesX + unTileX;
+
+			//tiles that are already pending still need their shadow refreshed, but don't need comparing
+			if ( m_vPendingTiles[ unTile ] || BTileDiffers( pPixels, unStrideBytes, unTileX, unTileY ))
+			{
+				CopyTileToShadow( pPixels, unStrideBytes, unTileX, unTileY );
+				m_vPendingTiles[ unTile ] = true;
+				bAnyPending = true;
+			}
+		}
+	}
+
+	return bAnyPending;
+}
+
+void DamageTracker::TakePendingRects( bool bMergePublished, std::vector<PixelRect> &vOutRects )
+{
+	vOutRects.clear();
+
+	for ( uint32_t unTile = 0; unTile < m_vPendingTiles.size(); unTile++ )
+	{
+		m_vPublishedTiles[ unTile ] = m_vPendingTiles[ unTile ] || ( bMergePublished && m_vPublishedTiles[ unTile ] );
+		m_vPendingTiles[ unTile ] = false;
+	}
+
+	//merge horizontal runs of dirty tiles, then grow a rect downwards while the row below has the exact same run
+	for ( uint32_t unTileY = 0; unTileY < m_unTilesY; unTileY++ )
+	{
+		uint32_t unTileX = 0;
+		while ( unTileX < m_unTilesX )
+		{
+			if ( !m_vPublishedTiles[ unTileY * m_unTilesX + unTileX ] )
+			{
+				unTileX++;
+				continue;
+			}
+
+			uint32_t unRunEnd = unTileX;
+			while ( unRunEnd + 1 < m_unTilesX && m_vPublishedTiles[ unTileY * m_unTilesX + unRunEnd + 1 ] )
+			{
+				unRunEnd++;
+			}
+
+			PixelRect first = GetTileRect( unTileX, unTileY );
+			PixelRect last = GetTileRect( unRunEnd, unTileY );
+			PixelRect run = {
+					.nX = first.nX,
+					.nY = first.nY,
+					.nWidth = last.nX + last.nWidth - first.nX,
+					.nHeight = first.nHeight,
+			};
+
+			auto it = std::find_if( vOutRects.begin(), vOutRects.end(), [ &run ]( const PixelRect &above )
+			{
+				return above.nX == run.nX && above.nWidth == run.nWidth && above.nY + above.nHeight == run.nY;
+			} );
+
+			if ( it != vOutRects.end())
+			{
+				it->nHeight += run.nHeight;
+			}
+			else
+			{
+				vOutRects.push_back( run );
+			}
+
+			unTileX = unRunEnd + 1;
+		}
+	}
+}
+
+void DamageTracker::MarkAllDirty()
+{
+	std::fill( m_vPendingTiles.begin(), m_vPendingTiles.end(), true );
+}
\ No newline at end of file
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+struct PixelRect
+{
+	int32_t nX = 0;
+	int32_t nY = 0;
+	int32_t nWidth = 0;
+	int32_t nHeight = 0;
+};
+
+// Finds which tiles of an RGBA8 frame changed since the previous frame.
+// Keeps a shadow copy of the last frame it saw, so after Update() the shadow always holds the full current frame
+// and dirty regions can be copied out of it.
+class DamageTracker
+{
+public:
+	DamageTracker( uint32_t unWidth, uint32_t unHeight, uint32_t unTileSize = 32 );
+
+	// Compares pPixels against the shadow frame, copies changed tiles into the shadow and adds them to the pending
+	// damage. Returns true if anything is pending.
+	bool Update( const uint8_t *pPixels, uint32_t unStrideBytes );
+
+	// Turns the pending damage into rectangles and clears it. If bMergePublished is set, the rectangles
+	// handed out last time are merged in too, for when the frame they were published with was never consumed.
+	void TakePendingRects( bool bMergePublished, std::vector<PixelRect> &vOutRects );
+
+	void MarkAllDirty();
+
+	const uint8_t *GetShadowFrame() const
+	{
+		return m_vShadowFrame.data();
+	}
+
+	uint32_t GetShadowStrideBytes() const
+	{
+		return m_unWidth * 4;
+	}
+
+private:
+	bool BTileDiffers( const uint8_t *pPixels, uint32_t unStrideBytes, uint32_t unTileX, uint32_t unTileY ) const;
+
+	void CopyTileToShadow( const uint8_t *pPixels, uint32_t unStrideBytes, uint32_t unTileX, uint32_t unTileY );
+
+	PixelRect GetTileRect( uint32_t unTileX, uint32_t unTileY ) const;
+
+	uint32_t m_unWidth;
+	uint32_t m_unHeight;
+	uint32_t m_unTileSize;
+
+	uint32_t m_unTilesX;
+	uint32_t m_unTilesY;
+
+	std::vector<uint8_t> m_vShadowFrame;
+
+	std::vector<bool> m_vPendingTiles;
+	std::vector<bool> m_vPublishedTiles;
+};
\ No newline at end of file
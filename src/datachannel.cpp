@@ -0,0 +1,95 @@
+#include "datachannel.h"
+
+#include <algorithm>
+#include <cstring>
+
+void DataChannel::Publish( uint32_t unSlot, const float *pValues, uint32_t unValueCount )
+{
+	if ( unSlot >= k_unSlotCount )
+	{
+		return;
+	}
+
+	Slot &slot = m_aSlots[ unSlot ];
+	unValueCount = std::min( unValueCount, k_unMaxSlotValues );
+
+	const uint32_t unSequence = slot.unSequence.load( std::memory_order_relaxed );
+	slot.unSequence.store( unSequence + 1, std::memory_order_relaxed );
+	std::atomic_thread_fence( std::memory_order_release );
+
+	slot.unValueCount.store( unValueCount, std::memory_order_relaxed );
+	for ( uint32_t i = 0; i < unValueCount; i++ )
+	{
+		slot.afValues[ i ].store( pValues[ i ], std::memory_order_relaxed );
+	}
+
+	slot.unSequence.store( unSequence + 2, std::memory_order_release );
+}
+
+uint32_t DataChannel::Read( uint32_t unSlot, float *pOutValues, uint32_t &unOutValueCount ) const
+{
+	unOutValueCount = 0;
+	if ( unSlot >= k_unSlotCount )
+	{
+		return 0;
+	}
+
+	const Slot &slot = m_aSlots[ unSlot ];
+	while ( true )
+	{
+		const uint32_t unSequenceBefore = slot.unSequence.load( std::memory_order_acquire );
+		if ( unSequenceBefore & 1 )
+		{
+			//the writer only holds the slot for a few stores
+			continue;
+		}
+
+		unOutValueCount = slot.unValueCount.load( std::memory_order_relaxed );
+		for ( uint32_t i = 0; i < unOutValueCount; i++ )
+		{
+			pOutValues[ i ] = slot.afValues[ i ].load( std::memory_order_relaxed );
+		}
+
+		std::atomic_thread_fence( std::memory_order_acquire );
+		if ( slot.unSequence.load( std::memory_order_relaxed ) == unSequenceBefore )
+		{
+			return unSequenceBefore / 2;
+		}
+	}
+}
+
+bool DataChannel::AppendChangedSlots( std::vector<uint8_t> &vOut )
+{
+	bool bAnyChanged = false;
+	for ( uint32_t unSlot = 0; unSlot < k_unSlotCount; unSlot++ )
+	{
+		//cheap check first, most slots won't have changed since the last snapshot
+		if ( m_aSlots[ unSlot ].unSequence.load( std::memory_order_relaxed ) / 2 == m_aSnapshotSequences[ unSlot ] )
+		{
+			continue;
+		}
+
+		std::array<float, k_unMaxSlotValues> afValues;
+		uint32_t unValueCount = 0;
+		const uint32_t unPublishCount = Read( unSlot, afValues.data(), unValueCount );
+		if ( unPublishCount == m_aSnapshotSequences[ unSlot ] )
+		{
+			continue;
+		}
+		m_aSnapshotSequences[ unSlot ] = unPublishCount;
+
+		const uint16_t usSlot = (uint16_t) unSlot;
+		const uint16_t usValueCount = (uint16_t) unValueCount;
+
+		const size_t unOffset = vOut.size();
+		vOut.resize( unOffset + 8 + unValueCount * sizeof( float ));
+		memcpy( vOut.data() + unOffset, &usSlot, 2 );
+		memcpy( vOut.data() + unOffset + 2, &usValueCount, 2 );
+		memcpy( vOut.data() + unOffset + 4, &unPublishCount, 4 );
+		memcpy( vOut.data() + unOffset + 8, afValues.data(), unValueCount * sizeof( float ));
+
+		bAnyChanged = true;
+	}
+
+	return bAnyChanged;
+}
\ No newline at end of file
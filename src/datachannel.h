@@ -0,0 +1,42 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// Latest-value slots for high frequency numeric data (poses, counters) headed for the page.
+// Each slot is a seqlock, so publishing never blocks or allocates and a reader only ever sees a complete value.
+// Every slot may have a single publishing thread at a time, and there is a single consumer taking snapshots.
+class DataChannel
+{
+public:
+	static constexpr uint32_t k_unSlotCount = 32;
+	static constexpr uint32_t k_unMaxSlotValues = 16;
+
+	// binary frame type the snapshots go to the page as, keep in sync with webview.html
+	static constexpr uint16_t k_usFrameType = 0xffff;
+
+	// Replaces the value of the slot, unValueCount is clamped to k_unMaxSlotValues.
+	void Publish( uint32_t unSlot, const float *pValues, uint32_t unValueCount );
+
+	// Copies out the latest value of the slot, returns its publish count (0 if nothing was published yet).
+	uint32_t Read( uint32_t unSlot, float *pOutValues, uint32_t &unOutValueCount ) const;
+
+	// Appends every slot published since the last call as "uint16 slot, uint16 value count, uint32 publish count,
+	// float values[count]", little endian. Returns false if nothing changed. Consumer side only.
+	bool AppendChangedSlots( std::vector<uint8_t> &vOut );
+
+private:
+	struct alignas( 64 ) Slot
+	{
+		//odd while a write is in progress, halved it is the publish count
+		std::atomic<uint32_t> unSequence = 0;
+		std::atomic<uint32_t> unValueCount = 0;
+		std::array<std::atomic<float>, k_unMaxSlotValues> afValues = {};
+	};
+
+	std::array<Slot, k_unSlotCount> m_aSlots;
+
+	std::array<uint32_t, k_unSlotCount> m_aSnapshotSequences = {};
+};
\ No newline at end of file
@@ -0,0 +1,142 @@
+#include "framestats.h"
+
+#include <algorithm>
+#include <cinttypes>
+
+#include "log.h"
+
+uint32_t LatencyHistogram::GetBucket( uint64_t ulValueUS )
+{
+	if ( ulValueUS < k_unExactBuckets )
+	{
+		return (uint32_t) ulValueUS;
+	}
+
+	if ( ulValueUS > UINT32_MAX )
+	{
+		return k_unBucketCount - 1;
+	}
+
+	//the two bits below the leading one pick the sub bucket
+	const uint32_t unExponent = 63 - __builtin_clzll( ulValueUS );
+	const uint32_t unSubBucket = ( ulValueUS >> ( unExponent - 2 )) & ( k_unSubBuckets - 1 );
+
+	return k_unExactBuckets + ( unExponent - 4 ) * k_unSubBuckets + unSubBucket;
+}
+
+uint64_t LatencyHistogram::GetBucketUpperBoundUS( uint32_t unBucket )
+{
+	if ( unBucket < k_unExactBuckets )
+	{
+		return unBucket;
+	}
+
+	const uint32_t unExponent = ( unBucket - k_unExactBuckets ) / k_unSubBuckets + 4;
+	const uint32_t unSubBucket = ( unBucket - k_unExactBuckets ) % k_unSubBuckets;
+
+	return ((uint64_t) ( k_unSubBuckets + unSubBucket + 1 ) << ( unExponent - 2 )) - 1;
+}
+
+void LatencyHistogram::Record( uint64_t ulValueUS )
+{
+	m_aBuckets[ GetBucket( ulValueUS ) ].fetch_add( 1, std::memory_order_relaxed );
+}
+
+uint64_t LatencyHistogram::GetCount() const
+{
+	uint64_t ulCount = 0;
+	for ( const std::atomic<uint32_t> &unBucket: m_aBuckets )
+	{
+		ulCount += unBucket.load( std::memory_order_relaxed );
+	}
+
+	return ulCount;
+}
+
+uint64_t LatencyHistogram::GetPercentileUS( float fPercentile ) const
+{
+	//buckets are read once, so a concurrent Record can't push the walk past the end
+	std::array<uint32_t, k_unBucketCount> aCounts;
+	uint64_t ulCount = 0;
+	for ( uint32_t i = 0; i < k_unBucketCount; i++ )
+	{
+		aCounts[ i ] = m_aBuckets[ i ].load( std::memory_order_relaxed );
+		ulCount += aCounts[ i ];
+	}
+
+	if ( ulCount == 0 )
+	{
+		return 0;
+	}
+
+	const uint64_t ulTarget = std::max<uint64_t>( 1, (uint64_t) ( fPercentile * (float) ulCount + 0.5f ));
+
+	uint64_t ulSeen = 0;
+	for ( uint32_t i = 0; i < k_unBucketCount; i++ )
+	{
+		ulSeen += aCounts[ i ];
+		if ( ulSeen >= ulTarget )
+		{
+			return GetBucketUpperBoundUS( i );
+		}
+	}
+
+	return GetBucketUpperBoundUS( k_unBucketCount - 1 );
+}
+
+void LatencyHistogram::Reset()
+{
+	for ( std::atomic<uint32_t> &unBucket: m_aBuckets )
+	{
+		unBucket.store( 0, std::memory_order_relaxed );
+	}
+}
+
+const char *GetPanelFrameStageName( EPanelFrameStage eStage )
+{
+	switch ( eStage )
+	{
+		case PANEL_FRAME_STAGE_DRAW_QUEUED:
+			return "draw queued";
+		case PANEL_FRAME_STAGE_DRAW:
+			return "draw";
+		case PANEL_FRAME_STAGE_CAPTURE:
+			return "capture";
+		case PANEL_FRAME_STAGE_HANDOFF:
+			return "handoff";
+		case PANEL_FRAME_STAGE_UPLOAD:
+			return "upload";
+		case PANEL_FRAME_STAGE_FRAME_AGE:
+			return "frame age";
+		default:
+			return "unknown";
+	}
+}
+
+void PanelFrameStats::LogSummary( const char *pchName ) const
+{
+	for ( uint32_t i = 0; i < PANEL_FRAME_STAGE_COUNT; i++ )
+	{
+		const LatencyHistogram &histogram = m_aHistograms[ i ];
+
+		const uint64_t ulCount = histogram.GetCount();
+		if ( ulCount == 0 )
+		{
+			continue;
+		}
+
+		Log( "[FrameStats] %s %-11s n=%-5" PRIu64 " p50 %6.2f ms  p95 %6.2f ms  p99 %6.2f ms", pchName,
+			 GetPanelFrameStageName((EPanelFrameStage) i ), ulCount,
+			 (double) histogram.GetPercentileUS( 0.50f ) / 1000.0,
+			 (double) histogram.GetPercentileUS( 0.95f ) / 1000.0,
+			 (double) histogram.GetPercentileUS( 0.99f ) / 1000.0 );
+	}
+}
+
+void PanelFrameStats::Reset()
+{
+	for ( LatencyHistogram &histogram: m_aHistograms )
+	{
+		histogram.Reset();
+	}
+}
\ No newline at end of file
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Histogram of durations in microseconds that can be recorded into from any thread without locking.
+// Values below 16us have their own bucket, above that every power of two is split into 4 buckets,
+// so percentiles are accurate to within 25%.
+class LatencyHistogram
+{
+public:
+	void Record( uint64_t ulValueUS );
+
+	// Returns the upper bound of the bucket holding the given percentile (0-1), 0 if nothing was recorded.
+	uint64_t GetPercentileUS( float fPercentile ) const;
+
+	uint64_t GetCount() const;
+
+	void Reset();
+
+private:
+	static constexpr uint32_t k_unExactBuckets = 16;
+	static constexpr uint32_t k_unSubBuckets = 4;
+	static constexpr uint32_t k_unBucketCount = k_unExactBuckets + ( 32 - 4 ) * k_unSubBuckets;
+
+	static uint32_t GetBucket( uint64_t ulValueUS );
+
+	static uint64_t GetBucketUpperBoundUS( uint32_t unBucket );
+
+	std::array<std::atomic<uint32_t>, k_unBucketCount> m_aBuckets{};
+};
+
+enum EPanelFrameStage
+{
+	PANEL_FRAME_STAGE_DRAW_QUEUED,  // RequestDraw posted until the UI thread started drawing
+	PANEL_FRAME_STAGE_DRAW,         // WebView drawing into its canvas
+	PANEL_FRAME_STAGE_CAPTURE,      // pixels taken out of the canvas and published
+	PANEL_FRAME_STAGE_HANDOFF,      // published until the render thread picked the frame up
+	PANEL_FRAME_STAGE_UPLOAD,       // render thread getting the frame into the swapchain image
+	PANEL_FRAME_STAGE_FRAME_AGE,    // RequestDraw posted until the frame was in the swapchain image
+
+	PANEL_FRAME_STAGE_COUNT,
+};
+
+const char *GetPanelFrameStageName( EPanelFrameStage eStage );
+
+class PanelFrameStats
+{
+public:
+	void Record( EPanelFrameStage eStage, uint64_t ulDurationUS )
+	{
+		m_aHistograms[ eStage ].Record( ulDurationUS );
+	}
+
+	const LatencyHistogram &GetHistogram( EPanelFrameStage eStage ) const
+	{
+		return m_aHistograms[ eStage ];
+	}
+
+	// Logs p50/p95/p99 of every stage that has samples.
+	void LogSummary( const char *pchName ) const;
+
+	void Reset();
+
+private:
+	std::array<LatencyHistogram, PANEL_FRAME_STAGE_COUNT> m_aHistograms;
+};
\ No newline at end of file
@@ -0,0 +1,292 @@
+#include "gesturerecognizer.h"
+
+#include <cmath>
+#include <utility>
+
+#include "log.h"
+#include "xrmath.h"
+
+//gap between the surfaces of the thumb and index tips
+static const float k_fPinchBeginMeters = 0.01f;
+static const float k_fPinchEndMeters = 0.025f;
+
+//average distance of the middle, ring and little tips from the palm
+static const float k_fCurlBeginMeters = 0.055f;
+static const float k_fCurlEndMeters = 0.075f;
+
+//distance of the index tip from the palm. A pinch needs it somewhat out so a closing fist doesn't pinch on the way,
+//a grab needs it curled in and a poke needs it pointing
+static const float k_fPinchMinIndexExtensionMeters = 0.05f;
+static const float k_fPokeBeginIndexExtensionMeters = 0.08f;
+static const float k_fPokeEndIndexExtensionMeters = 0.07f;
+
+//tracking tends to snap fingers together during fast motion, so a pinch can't begin while the index tip is this fast
+static const float k_fPinchBeginMaxSpeed = 1.5f;
+
+//a grab becomes a scroll once the palm has moved this far, so closing the hand in place doesn't press anything
+static const float k_fScrollBeginMeters = 0.025f;
+
+//time constant of the velocity low pass, after longer gaps between snapshots velocity starts over
+static const float k_fVelocityFilterSeconds = 0.05f;
+static const XrTime k_velocityResetGapNS = 100000000;
+
+//every gesture of both hands can be active at once, and each needs room for its end
+static const uint32_t k_unReservedEndEvents = 2 * 4;
+
+static float Distance( const XrVector3f &a, const XrVector3f &b )
+{
+	XrVector3f vecDelta;
+	XrVector3f_Sub( &vecDelta, &a, &b );
+	return XrVector3f_Length( &vecDelta );
+}
+
+static void FilterVelocity( XrVector3f &vecVelocity, const XrVector3f &vecPosition, const XrVector3f &vecLastPosition,
+							float fSeconds, float fBlend )
+{
+	XrVector3f vecInstant;
+	XrVector3f_Sub( &vecInstant, &vecPosition, &vecLastPosition );
+	XrVector3f_Scale( &vecInstant, &vecInstant, 1.f / fSeconds );
+	XrVector3f_Lerp( &vecVelocity, &vecVelocity, &vecInstant, fBlend );
+}
+
+GestureRecognizer::~GestureRecognizer()
+{
+	Stop();
+}
+
+void GestureRecognizer::Start( XRQHandJointCache &handJoints )
+{
+	if ( BIsRunning())
+	{
+		return;
+	}
+
+	m_pHandJoints = &handJoints;
+	m_bStopRequested = false;
+	m_aHands = {};
+
+	m_thread = std::thread( &GestureRecognizer::ThreadMain, this );
+	Log( "[GestureRecognizer] Started" );
+}
+
+void GestureRecognizer::Stop()
+{
+	if ( !BIsRunning())
+	{
+		return;
+	}
+
+	{
+		std::scoped_lock<std::mutex> lock( m_mutWake );
+		m_bStopRequested = true;
+	}
+	m_cvWake.notify_one();
+
+	m_thread.join();
+}
+
+void GestureRecognizer::NotifyHandsLocated()
+{
+	if ( !BIsRunning())
+	{
+		return;
+	}
+
+	{
+		std::scoped_lock<std::mutex> lock( m_mutWake );
+		m_ulHandsLocatedCount++;
+	}
+	m_cvWake.notify_one();
+}
+
+void GestureRecognizer::ThreadMain()
+{
+	uint64_t ulSeenCount = 0;
+	XrTime lastSnapshotTime = 0;
+
+	while ( true )
+	{
+		{
+			std::unique_lock<std::mutex> lock( m_mutWake );
+			m_cvWake.wait( lock, [this, ulSeenCount]()
+			{
+				return m_bStopRequested || m_ulHandsLocatedCount != ulSeenCount;
+			} );
+
+			if ( m_bStopRequested )
+			{
+				return;
+			}
+
+			ulSeenCount = m_ulHandsLocatedCount;
+		}
+
+		//several notifications may have piled up, the latest snapshot covers them all
+		const XRQHandJointsSnapshot &snapshot = m_pHandJoints->TakeLatest();
+		if ( snapshot.time == lastSnapshotTime )
+		{
+			continue;
+		}
+		lastSnapshotTime = snapshot.time;
+
+		for ( int i = 0; i < 2; i++ )
+		{
+			RecognizeHand( (XRQHand) i, snapshot.aHands[ i ], snapshot.time );
+		}
+	}
+}
+
+void GestureRecognizer::RecognizeHand( XRQHand hand, const XRQHandJoints &joints, XrTime time )
+{
+	static const XrHandJointEXT k_aUsedJoints[] = {
+			XR_HAND_JOINT_PALM_EXT, XR_HAND_JOINT_THUMB_TIP_EXT, XR_HAND_JOINT_INDEX_TIP_EXT,
+			XR_HAND_JOINT_MIDDLE_TIP_EXT, XR_HAND_JOINT_RING_TIP_EXT, XR_HAND_JOINT_LITTLE_TIP_EXT,
+	};
+
+	for ( XrHandJointEXT joint: k_aUsedJoints )
+	{
+		if ( !joints.bIsActive || !( joints.aLocationFlags[ joint ] & XR_SPACE_LOCATION_POSITION_VALID_BIT ) ||
+			 !( joints.aLocationFlags[ joint ] & XR_SPACE_LOCATION_ORIENTATION_VALID_BIT ))
+		{
+			LoseHand( hand, time );
+			return;
+		}
+	}
+
+	HandState &state = m_aHands[ hand ];
+
+	const XrPosef palmPose = {
+			.orientation = joints.aOrientations[ XR_HAND_JOINT_PALM_EXT ],
+			.position = joints.aPositions[ XR_HAND_JOINT_PALM_EXT ],
+	};
+	const XrPosef indexTipPose = {
+			.orientation = joints.aOrientations[ XR_HAND_JOINT_INDEX_TIP_EXT ],
+			.position = joints.aPositions[ XR_HAND_JOINT_INDEX_TIP_EXT ],
+	};
+	const XrVector3f &vecPalm = palmPose.position;
+	const XrVector3f &vecThumbTip = joints.aPositions[ XR_HAND_JOINT_THUMB_TIP_EXT ];
+	const XrVector3f &vecIndexTip = indexTipPose.position;
+
+	const XrTime sinceLastNS = time - state.lastTime;
+	if ( state.lastTime == 0 || sinceLastNS <= 0 || sinceLastNS > k_velocityResetGapNS )
+	{
+		state.vecPalmVelocity = {};
+		state.vecIndexTipVelocity = {};
+	}
+	else
+	{
+		const float fSeconds = (float) sinceLastNS * 1e-9f;
+		const float fBlend = 1.f - expf( -fSeconds / k_fVelocityFilterSeconds );
+		FilterVelocity( state.vecPalmVelocity, vecPalm, state.lastPalmPose.position, fSeconds, fBlend );
+		FilterVelocity( state.vecIndexTipVelocity, vecIndexTip, state.vecLastIndexTip, fSeconds, fBlend );
+	}
+	state.lastTime = time;
+	state.lastPalmPose = palmPose;
+	state.vecLastIndexTip = vecIndexTip;
+
+	const float fPinchGap = Distance( vecThumbTip, vecIndexTip ) -
+							joints.afRadii[ XR_HAND_JOINT_THUMB_TIP_EXT ] - joints.afRadii[ XR_HAND_JOINT_INDEX_TIP_EXT ];
+	const float fIndexExtension = Distance( vecIndexTip, vecPalm );
+	const float fCurl = ( Distance( joints.aPositions[ XR_HAND_JOINT_MIDDLE_TIP_EXT ], vecPalm ) +
+						  Distance( joints.aPositions[ XR_HAND_JOINT_RING_TIP_EXT ], vecPalm ) +
+						  Distance( joints.aPositions[ XR_HAND_JOINT_LITTLE_TIP_EXT ], vecPalm )) / 3.f;
+	const float fIndexSpeed = XrVector3f_Length( &state.vecIndexTipVelocity );
+
+	//every gesture has to get further past its threshold to end than it took to begin, so it doesn't chatter
+	const bool bGrabbing = state.bGrabbing
+						   ? fCurl < k_fCurlEndMeters
+						   : fCurl < k_fCurlBeginMeters && fIndexExtension < k_fPokeEndIndexExtensionMeters;
+	const bool bPinching = !bGrabbing && ( state.bPinching
+										   ? fPinchGap < k_fPinchEndMeters
+										   : fPinchGap < k_fPinchBeginMeters && fIndexExtension > k_fPinchMinIndexExtensionMeters &&
+											 fIndexSpeed < k_fPinchBeginMaxSpeed );
+	const bool bPoking = !bPinching && ( state.bPoking
+										 ? fIndexExtension > k_fPokeEndIndexExtensionMeters && fCurl < k_fCurlEndMeters
+										 : fIndexExtension > k_fPokeBeginIndexExtensionMeters && fCurl < k_fCurlBeginMeters );
+
+	if ( bGrabbing && !state.bGrabbing )
+	{
+		state.vecGrabStart = vecPalm;
+	}
+	const bool bScrolling = bGrabbing && ( state.bScrolling || Distance( vecPalm, state.vecGrabStart ) > k_fScrollBeginMeters );
+
+	XrPosef pinchPose = palmPose;
+	XrVector3f_Lerp( &pinchPose.position, &vecThumbTip, &vecIndexTip, .5f );
+
+	//ordered so a scroll ends before its grab and a pinch a grab takes over from ends before the grab begins
+	auto Transition = [&]( EGestureType eType, bool &bWas, bool bIs, bool bSendsUpdates, const XrPosef &pose,
+						   const XrVector3f &vecVelocity )
+	{
+		if ( bIs != bWas )
+		{
+			//a dropped begin leaves the gesture inactive, it begins again on a later snapshot if it still holds
+			if ( BPushEvent( eType, bIs ? GESTURE_PHASE_BEGIN : GESTURE_PHASE_END, hand, time, pose, vecVelocity ) || !bIs )
+			{
+				bWas = bIs;
+			}
+		}
+		else if ( bIs && bSendsUpdates )
+		{
+			BPushEvent( eType, GESTURE_PHASE_UPDATE, hand, time, pose, vecVelocity );
+		}
+	};
+
+	Transition( GESTURE_SCROLL, state.bScrolling, bScrolling, true, palmPose, state.vecPalmVelocity );
+	Transition( GESTURE_PINCH, state.bPinching, bPinching, false, pinchPose, state.vecIndexTipVelocity );
+	Transition( GESTURE_POKE, state.bPoking, bPoking, true, indexTipPose, state.vecIndexTipVelocity );
+	Transition( GESTURE_GRAB, state.bGrabbing, bGrabbing, false, palmPose, state.vecPalmVelocity );
+}
+
+void GestureRecognizer::LoseHand( XRQHand hand, XrTime time )
+{
+	HandState &state = m_aHands[ hand ];
+
+	const XrVector3f vecStill = {};
+	const std::pair<EGestureType, bool> aActive[] = {
+			{GESTURE_SCROLL, state.bScrolling},
+			{GESTURE_PINCH,  state.bPinching},
+			{GESTURE_POKE,   state.bPoking},
+			{GESTURE_GRAB,   state.bGrabbing},
+	};
+	for ( const auto &[ eType, bActive ]: aActive )
+	{
+		if ( bActive )
+		{
+			BPushEvent( eType, GESTURE_PHASE_END, hand, time, state.lastPalmPose, vecStill );
+		}
+	}
+
+	state = {};
+}
+
+bool GestureRecognizer::BPushEvent( EGestureType eType, EGesturePhase ePhase, XRQHand hand, XrTime time, const XrPosef &pose,
+									const XrVector3f &vecVelocity )
+{
+	const GestureEvent event = {
+			.eType = eType,
+			.ePhase = ePhase,
+			.hand = hand,
+			.time = time,
+			.pose = pose,
+			.vecVelocity = vecVelocity,
+	};
+
+	//begins and updates only ever leave the reserved room to ends. A begin only goes in with more than the reserve
+	//free, so there is always at least as much room left as there are active gestures to end
+	if ( ePhase != GESTURE_PHASE_END && m_queueEvents.GetFreeCount() <= k_unReservedEndEvents )
+	{
+		if ( m_unDroppedEvents++ == 0 )
+		{
+			Log( LogWarning, "[GestureRecognizer] Event queue full, gestures are being dropped" );
+		}
+		return false;
+	}
+
+	if ( !m_queueEvents.BPush( event ))
+	{
+		Log( LogError, "[GestureRecognizer] No room left for a gesture end" );
+		return false;
+	}
+
+	return true;
+}
\ No newline at end of file
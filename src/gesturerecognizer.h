@@ -0,0 +1,111 @@
+#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#include "spscqueue.h"
+#include "xrq.h"
+
+enum EGestureType
+{
+	GESTURE_PINCH,
+	GESTURE_GRAB,
+	GESTURE_POKE,
+	GESTURE_SCROLL,
+};
+
+enum EGesturePhase
+{
+	GESTURE_PHASE_BEGIN,
+	GESTURE_PHASE_UPDATE,
+	GESTURE_PHASE_END,
+};
+
+struct GestureEvent
+{
+	EGestureType eType;
+	EGesturePhase ePhase;
+	XRQHand hand;
+
+	//display time of the hand snapshot the gesture was recognized in
+	XrTime time;
+
+	//in the play space. Between the thumb and index tips for pinches, the index tip with -Z down the finger for pokes,
+	//the palm for grabs and scrolls
+	XrPosef pose;
+
+	//filtered, in meters per second
+	XrVector3f vecVelocity;
+};
+
+// Recognizes pinches, grabs, pokes and scrolls on a worker thread, from the hand snapshots XRQLocateHandJointsFrame
+// publishes. Every gesture that begins also ends, including when the hand stops being tracked. Pokes and scrolls
+// send an update with their pose every snapshot in between, pinches and grabs only begin and end.
+class GestureRecognizer
+{
+public:
+	~GestureRecognizer();
+
+	// From here on the worker is the one thread taking snapshots from handJoints.
+	void Start( XRQHandJointCache &handJoints );
+
+	void Stop();
+
+	bool BIsRunning() const { return m_thread.joinable(); }
+
+	// Call after every XRQLocateHandJointsFrame, wakes the worker up to look at the new snapshot.
+	void NotifyHandsLocated();
+
+	// Single consumer, false once every recognized event has been taken.
+	bool BPopEvent( GestureEvent &outEvent ) { return m_queueEvents.BPop( outEvent ); }
+
+private:
+	struct HandState
+	{
+		//0 until the hand has been seen since it was last lost
+		XrTime lastTime = 0;
+
+		//the palm pose also goes out with the ends sent when the hand is lost
+		XrPosef lastPalmPose{};
+		XrVector3f vecLastIndexTip{};
+		XrVector3f vecPalmVelocity{};
+		XrVector3f vecIndexTipVelocity{};
+
+		bool bPinching = false;
+		bool bGrabbing = false;
+		bool bPoking = false;
+		bool bScrolling = false;
+
+		XrVector3f vecGrabStart{};
+	};
+
+	void ThreadMain();
+
+	void RecognizeHand( XRQHand hand, const XRQHandJoints &joints, XrTime time );
+
+	//ends everything the hand was doing and forgets it
+	void LoseHand( XRQHand hand, XrTime time );
+
+	//ends always get through, begins and updates are dropped once the queue is down to the room reserved for ends.
+	//A gesture whose begin was dropped is not active, so it doesn't send an end either
+	bool BPushEvent( EGestureType eType, EGesturePhase ePhase, XRQHand hand, XrTime time, const XrPosef &pose,
+					 const XrVector3f &vecVelocity );
+
+	std::thread m_thread;
+	XRQHandJointCache *m_pHandJoints = nullptr;
+
+	std::mutex m_mutWake;
+	std::condition_variable m_cvWake;
+	bool m_bStopRequested = false;
+	uint64_t m_ulHandsLocatedCount = 0;
+
+	//only touched on the worker thread
+	std::array<HandState, 2> m_aHands;
+	uint32_t m_unDroppedEvents = 0;
+
+	//a few seconds worth even if the consumer stops taking them, beyond that only ends of active gestures get in
+	SPSCQueue<GestureEvent, 256> m_queueEvents;
+};
\ No newline at end of file
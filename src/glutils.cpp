@@ -5,6 +5,7 @@
 #include <map>
 
 #include "check.h"
+#include "timeutils.h"
 
 extern EGLDisplay egl_display;
 extern EGLSurface egl_surface;
@@ -363,10 +364,12 @@ const std::string PANEL_VERTEX_SHADER = R"glsl(#version 300 es
         layout (location = 0) in vec3 vertexPosition;
         in vec2 vertexUv;
 
+        uniform mat4 textureTransform;
+
         out vec2 texCoord;
         void main() {
             gl_Position = vec4(vertexPosition, 1.0);
-            texCoord = vertexUv;
+            texCoord = (textureTransform * vec4(vertexUv, 0.0, 1.0)).xy;
         }
     )glsl";
 
@@ -381,16 +384,42 @@ static const std::string PANEL_FRAGMENT_SHADER = R"glsl(#version 300 es
         }
 )glsl";
 
+// External images are not sRGB textures, so they sample as encoded values. They are decoded here so that writing
+// into an sRGB render target encodes them back to the original values.
+static const std::string PANEL_OES_FRAGMENT_SHADER = R"glsl(#version 300 es
+        #extension GL_OES_EGL_image_external_essl3 : require
+        precision mediump float;
+
+        uniform samplerExternalOES panelTexture;
+        in vec2 texCoord;
+
+        out vec4 out_FragColor;
+
+        vec3 SRGBToLinear(vec3 color)
+        {
+            return mix(color / 12.92, pow((color + 0.055) / 1.055, vec3(2.4)), step(vec3(0.04045), color));
+        }
+
+        void main()
+        {
+            vec4 color = texture(panelTexture, texCoord);
+            out_FragColor = vec4(SRGBToLinear(color.rgb), color.a);
+        }
+)glsl";
+
 PanelRenderer::PanelRenderer( PanelConfig config ) : m_panelConfig( config )
 {
 	m_pFramebuffer = std::make_unique<FrameBuffer>();
 
 	m_pShader = std::make_unique<Shader>( PANEL_VERTEX_SHADER, PANEL_FRAGMENT_SHADER );
+	m_pOESShader = std::make_unique<Shader>( PANEL_VERTEX_SHADER, PANEL_OES_FRAGMENT_SHADER );
 	for ( const auto &[location, name]: kPanelVertexAttributeLocations )
 	{
 		m_pShader->BindAttribLocation( location, name );
+		m_pOESShader->BindAttribLocation( location, name );
 	}
 	m_pShader->LinkShader();
+	m_pOESShader->LinkShader();
 
 	m_panelGeometry.nVertexCount = 6;
 	m_panelGeometry.nIndexCount = 0;
@@ -449,26 +478,41 @@ PanelRenderer::PanelRenderer( PanelConfig config ) : m_panelConfig( config )
 	GL_CHECK( glBindBuffer( GL_ARRAY_BUFFER, 0 ));
 }
 
+void PanelRenderer::BindShaderForTexture( const std::unique_ptr<Texture> &panelTexture, const glm::mat4 &textureTransform )
+{
+	Shader *pShader = panelTexture->IsOES() ? m_pOESShader.get() : m_pShader.get();
+
+	pShader->BindShader();
+	pShader->SetUniformMat4( "textureTransform", textureTransform );
+	pShader->BindVertexArray( m_panelGeometry.unVertexArrayObject );
+
+	GL_CHECK( glActiveTexture( GL_TEXTURE0 ));
+	GL_CHECK( glBindTexture( panelTexture->GetTarget(), panelTexture->GetGLTexture()));
+}
+
 void
 PanelRenderer::RenderToTexture( const glm::mat4 &view, const glm::mat4 &projection,
 								const std::unique_ptr<Texture> &panelTexture,
-								const GLuint renderTexture, const int renderWidth, const int renderHeight )
+								const GLuint renderTexture, const int renderWidth, const int renderHeight,
+								const glm::mat4 &textureTransform, const int renderX, const int renderY )
 {
 	m_pFramebuffer->BindFramebufferWithTexture( renderTexture );
 
-	GL_CHECK( glViewport( 0, 0, renderWidth, renderHeight ));
+	//the scissor keeps the clear inside the rect, renderTexture may be shared with other panels
+	GL_CHECK( glViewport( renderX, renderY, renderWidth, renderHeight ));
+	GL_CHECK( glScissor( renderX, renderY, renderWidth, renderHeight ));
+	GL_CHECK( glEnable( GL_SCISSOR_TEST ));
 	GL_CHECK( glClearColor( 0.f, 0.f, 0.f, 0.f ));
 	GL_CHECK( glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT ));
+	GL_CHECK( glDisable( GL_SCISSOR_TEST ));
 
-	m_pShader->BindShader();
-	m_pShader->BindVertexArray( m_panelGeometry.unVertexArrayObject );
-
-	GL_CHECK( glActiveTexture( GL_TEXTURE0 ));
-	GL_CHECK( glBindTexture( GL_TEXTURE_2D, panelTexture->GetGLTexture()));
+	BindShaderForTexture( panelTexture, textureTransform );
 
 	GL_CHECK( glBindVertexArray( m_panelGeometry.unVertexArrayObject ));
 	GL_CHECK( glDrawArrays( GL_TRIANGLES, 0, m_panelGeometry.nVertexCount ));
 
+	GL_CHECK( glBindTexture( panelTexture->GetTarget(), 0 ));
+
 	m_pFramebuffer->Unbind();
 }
 
@@ -481,11 +525,7 @@ void PanelRenderer::RenderToScreen( const std::unique_ptr<Texture> &panelTexture
 	GL_CHECK( glClearColor( 0.f, 0.f, 0.f, 0.f ));
 	GL_CHECK( glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT ));
 
-	m_pShader->BindShader();
-	m_pShader->BindVertexArray( m_panelGeometry.unVertexArrayObject );
-
-	GL_CHECK( glActiveTexture( GL_TEXTURE0 ));
-	GL_CHECK( glBindTexture( GL_TEXTURE_2D, panelTexture->GetGLTexture()));
+	BindShaderForTexture( panelTexture, glm::mat4( 1.f ));
 
 	GL_CHECK( glBindVertexArray( m_panelGeometry.unVertexArrayObject ));
 	GL_CHECK( glDrawArrays( GL_TRIANGLES, 0, m_panelGeometry.nVertexCount ));
@@ -498,6 +538,170 @@ const PanelConfig &PanelRenderer::GetPanelConfig()
 	return m_panelConfig;
 }
 
+PixelBufferRing::PixelBufferRing( uint32_t unSlotCount, uint32_t unWidth, uint32_t unHeight )
+	: m_handoff( unSlotCount )
+{
+	m_unSlotCount = unSlotCount;
+	m_unWidth = unWidth;
+	m_unHeight = unHeight;
+	m_unSlotSizeBytes = unWidth * unHeight * 4;
+
+	m_pSlots = std::make_unique<Slot[]>( m_unSlotCount );
+	for ( uint32_t i = 0; i < m_unSlotCount; i++ )
+	{
+		GL_CHECK( glGenBuffers( 1, &m_pSlots[ i ].unBuffer ));
+		GL_CHECK( glBindBuffer( GL_PIXEL_UNPACK_BUFFER, m_pSlots[ i ].unBuffer ));
+		GL_CHECK( glBufferData( GL_PIXEL_UNPACK_BUFFER, m_unSlotSizeBytes, nullptr, GL_STREAM_DRAW ));
+	}
+	GL_CHECK( glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 ));
+
+	//slots start in flight without a fence, so the first recycle maps all of them
+	RecycleCompletedSlots();
+}
+
+uint8_t *PixelBufferRing::BeginWrite( int &nOutSlot, bool &bOutReclaimed )
+{
+	nOutSlot = m_handoff.BeginWrite( bOutReclaimed );
+	if ( nOutSlot < 0 )
+	{
+		return nullptr;
+	}
+
+	if ( bOutReclaimed )
+	{
+		m_ulSupersededFrames.fetch_add( 1, std::memory_order_relaxed );
+	}
+	return m_pSlots[ nOutSlot ].pMapped;
+}
+
+std::vector<PixelRect> &PixelBufferRing::GetDirtyRects( int nSlot )
+{
+	return m_pSlots[ nSlot ].vDirtyRects;
+}
+
+void PixelBufferRing::EndWrite( int nSlot, uint64_t ulFrameTimeUS, uint64_t ulFrameId )
+{
+	//published by the release below, read by the GL thread after it acquires the slot
+	m_pSlots[ nSlot ].ulPublishTimeUS = GetCurrentTimeUS();
+	m_pSlots[ nSlot ].ulFrameTimeUS = ulFrameTimeUS;
+	m_pSlots[ nSlot ].ulFrameId = ulFrameId;
+	m_handoff.EndWrite( nSlot );
+}
+
+void PixelBufferRing::AbortWrite( int nSlot )
+{
+	m_handoff.AbortWrite( nSlot );
+}
+
+void PixelBufferRing::RecycleCompletedSlots()
+{
+	for ( uint32_t i = 0; i < m_unSlotCount; i++ )
+	{
+		Slot &slot = m_pSlots[ i ];
+		if ( !m_handoff.BIsInFlight((int) i ))
+		{
+			continue;
+		}
+
+		if ( slot.fence )
+		{
+			GLenum result = glClientWaitSync( slot.fence, 0, 0 );
+			if ( result == GL_TIMEOUT_EXPIRED )
+			{
+				continue;
+			}
+
+			GL_CHECK( glDeleteSync( slot.fence ));
+			slot.fence = nullptr;
+		}
+
+		//the fence has signalled, so there is nothing for the driver to synchronize against
+		GL_CHECK( glBindBuffer( GL_PIXEL_UNPACK_BUFFER, slot.unBuffer ));
+		GL_CHECK( slot.pMapped = (uint8_t *) glMapBufferRange( GL_PIXEL_UNPACK_BUFFER, 0, m_unSlotSizeBytes,
+																 GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT |
+																 GL_MAP_UNSYNCHRONIZED_BIT ));
+		if ( !slot.pMapped )
+		{
+			Log( LogError, "[GLUtils] Failed to map pixel buffer slot %u", i );
+			continue;
+		}
+
+		m_handoff.Release((int) i );
+	}
+
+	GL_CHECK( glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 ));
+}
+
+uint64_t PixelBufferRing::UploadToTexture( GLuint texture )
+{
+	RecycleCompletedSlots();
+
+	const int nSlot = m_handoff.Acquire();
+	if ( nSlot < 0 )
+	{
+		return 0;
+	}
+
+	Slot &slot = m_pSlots[ nSlot ];
+
+	m_ulLastHandoffLatencyUS = GetCurrentTimeUS() - slot.ulPublishTimeUS;
+	m_ulLastFrameTimeUS = slot.ulFrameTimeUS;
+	m_ulLastFrameId = slot.ulFrameId;
+
+	GL_CHECK( glBindBuffer( GL_PIXEL_UNPACK_BUFFER, slot.unBuffer ));
+	GL_CHECK( GLboolean bUnmapped = glUnmapBuffer( GL_PIXEL_UNPACK_BUFFER ));
+	slot.pMapped = nullptr;
+
+	if ( !bUnmapped )
+	{
+		Log( LogWarning, "[GLUtils] Pixel buffer slot %d contents were lost while mapped, dropping frame", nSlot );
+		GL_CHECK( glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 ));
+		m_bFrameLost.store( true, std::memory_order_relaxed );
+		return 0;
+	}
+
+	uint64_t ulUploadedBytes = 0;
+
+	GL_CHECK( glBindTexture( GL_TEXTURE_2D, texture ));
+	GL_CHECK( glPixelStorei( GL_UNPACK_ROW_LENGTH, (GLint) m_unWidth ));
+	for ( const PixelRect &rect: slot.vDirtyRects )
+	{
+		const uintptr_t unOffset = ( rect.nY * m_unWidth + rect.nX ) * 4;
+		GL_CHECK( glTexSubImage2D( GL_TEXTURE_2D, 0, rect.nX, rect.nY, rect.nWidth, rect.nHeight, GL_RGBA,
+								   GL_UNSIGNED_BYTE, (const void *) unOffset ));
+
+		ulUploadedBytes += (uint64_t) rect.nWidth * rect.nHeight * 4;
+	}
+	GL_CHECK( glPixelStorei( GL_UNPACK_ROW_LENGTH, 0 ));
+	GL_CHECK( glBindTexture( GL_TEXTURE_2D, 0 ));
+	GL_CHECK( glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 ));
+
+	GL_CHECK( slot.fence = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 ));
+
+	return ulUploadedBytes;
+}
+
+PixelBufferRing::~PixelBufferRing()
+{
+	for ( uint32_t i = 0; i < m_unSlotCount; i++ )
+	{
+		Slot &slot = m_pSlots[ i ];
+		if ( slot.pMapped )
+		{
+			GL_CHECK( glBindBuffer( GL_PIXEL_UNPACK_BUFFER, slot.unBuffer ));
+			GL_CHECK( glUnmapBuffer( GL_PIXEL_UNPACK_BUFFER ));
+		}
+
+		if ( slot.fence )
+		{
+			GL_CHECK( glDeleteSync( slot.fence ));
+		}
+
+		GL_CHECK( glDeleteBuffers( 1, &slot.unBuffer ));
+	}
+	GL_CHECK( glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 ));
+}
+
 void SwapBuffers()
 {
 	eglSwapBuffers( egl_display, egl_surface );
@@ -11,6 +11,10 @@
 #include <EGL/eglext.h>
 
 #include "glm/glm.hpp"
+#include "damagetracker.h"
+#include "slothandoff.h"
+#include <atomic>
+#include <memory>
 #include <mutex>
 
 class Texture
@@ -187,6 +191,16 @@ struct Geometry
 	~Geometry();
 };
 
+enum EWebViewCaptureMode
+{
+	// WebView draws into a bitmap on a software canvas, changed tiles are streamed through pixel unpack buffers
+	WEBVIEW_CAPTURE_MODE_SOFTWARE,
+
+	// WebView draws into a SurfaceTexture on a hardware canvas, which is sampled as an external texture without
+	// any CPU copies
+	WEBVIEW_CAPTURE_MODE_SURFACE_TEXTURE,
+};
+
 struct PanelConfig
 {
 	float fWidthMeters;
@@ -196,6 +210,11 @@ struct PanelConfig
 	uint32_t unTextureHeight;
 
 	float fRefreshRate = 60.f;
+
+	EWebViewCaptureMode eCaptureMode = WEBVIEW_CAPTURE_MODE_SOFTWARE;
+
+	//small panels can share one swapchain with others instead of getting their own
+	bool bPackIntoAtlas = false;
 };
 
 class PanelRenderer
@@ -203,22 +222,122 @@ class PanelRenderer
 public:
 	PanelRenderer( PanelConfig config );
 
+	// textureTransform is applied to the panel uvs, e.g. the transform matrix of a SurfaceTexture.
+	// Only the renderWidth x renderHeight rect at renderX, renderY is touched, the rest of renderTexture is left alone.
 	void
 	RenderToTexture( const glm::mat4 &view, const glm::mat4 &projection, const std::unique_ptr<Texture> &panelTexture,
-					 const GLuint renderTexture, const int renderWidth, const int renderHeight );
+					 const GLuint renderTexture, const int renderWidth, const int renderHeight,
+					 const glm::mat4 &textureTransform = glm::mat4( 1.f ), const int renderX = 0, const int renderY = 0 );
 
 	void RenderToScreen( const std::unique_ptr<Texture> &panelTexture, const int renderWidth, const int renderHeight );
 
 	const PanelConfig &GetPanelConfig();
 
 private:
+	void BindShaderForTexture( const std::unique_ptr<Texture> &panelTexture, const glm::mat4 &textureTransform );
+
 	PanelConfig m_panelConfig;
 
 	Geometry m_panelGeometry;
 
 	std::unique_ptr<Shader> m_pShader;
+	std::unique_ptr<Shader> m_pOESShader;
 
 	std::unique_ptr<FrameBuffer> m_pFramebuffer;
 };
 
+// Ring of pixel unpack buffers used to stream frames produced on another thread into a texture.
+// Slots are mapped on the GL thread and filled by the producer while the GL thread streams a previously
+// completed slot into the texture. Each upload is fenced so a slot is not remapped before the GPU has read it.
+// A slot only needs valid pixels inside the dirty rects it is published with.
+class PixelBufferRing
+{
+public:
+	PixelBufferRing( uint32_t unSlotCount, uint32_t unWidth, uint32_t unHeight );
+
+	// Producer side, may be called from any thread. Returns nullptr if no mapped slot is available.
+	// If the previous frame has not been picked up by the GL thread yet, its slot is reused and
+	// bOutReclaimed is set, in which case the new dirty rects must also cover the old ones.
+	uint8_t *BeginWrite( int &nOutSlot, bool &bOutReclaimed );
+
+	// Producer side, only valid between BeginWrite and EndWrite.
+	std::vector<PixelRect> &GetDirtyRects( int nSlot );
+
+	// ulFrameTimeUS and ulFrameId are handed back by GetLastFrameTimeUS and GetLastFrameId once the frame has been uploaded.
+	void EndWrite( int nSlot, uint64_t ulFrameTimeUS, uint64_t ulFrameId );
+
+	void AbortWrite( int nSlot );
+
+	// GL thread only. Recycles slots whose uploads have completed and streams the dirty rects of the newest
+	// complete frame into texture. Returns the number of bytes uploaded, 0 if there was no new frame.
+	uint64_t UploadToTexture( GLuint texture );
+
+	uint32_t GetStrideBytes() const
+	{
+		return m_unWidth * 4;
+	}
+
+	// GL thread only. Time between EndWrite and UploadToTexture for the last uploaded frame.
+	uint64_t GetLastHandoffLatencyUS() const
+	{
+		return m_ulLastHandoffLatencyUS;
+	}
+
+	// GL thread only. Timestamp the last uploaded frame was published with.
+	uint64_t GetLastFrameTimeUS() const
+	{
+		return m_ulLastFrameTimeUS;
+	}
+
+	// GL thread only. Id the last uploaded frame was published with.
+	uint64_t GetLastFrameId() const
+	{
+		return m_ulLastFrameId;
+	}
+
+	// Producer side. True once after the GL thread lost a frame's contents, the producer then has to publish the
+	// whole frame again since the texture never received that frame's dirty rects.
+	bool BTakeLostFrame()
+	{
+		return m_bFrameLost.exchange( false, std::memory_order_relaxed );
+	}
+
+	// Number of complete frames that were replaced by a newer one before the GL thread picked them up.
+	uint64_t GetSupersededFrameCount() const
+	{
+		return m_ulSupersededFrames.load( std::memory_order_relaxed );
+	}
+
+	~PixelBufferRing();
+
+private:
+	struct Slot
+	{
+		GLuint unBuffer = 0;
+		GLsync fence = nullptr;
+		uint8_t *pMapped = nullptr;
+		std::vector<PixelRect> vDirtyRects;
+		uint64_t ulPublishTimeUS = 0;
+		uint64_t ulFrameTimeUS = 0;
+		uint64_t ulFrameId = 0;
+	};
+
+	void RecycleCompletedSlots();
+
+	//in flight slots are unmapped and waiting on their fence before they can be remapped
+	SlotHandoff m_handoff;
+	std::unique_ptr<Slot[]> m_pSlots;
+	uint32_t m_unSlotCount = 0;
+
+	uint32_t m_unWidth = 0;
+	uint32_t m_unHeight = 0;
+	uint32_t m_unSlotSizeBytes = 0;
+
+	uint64_t m_ulLastHandoffLatencyUS = 0;
+	uint64_t m_ulLastFrameTimeUS = 0;
+	uint64_t m_ulLastFrameId = 0;
+	std::atomic<uint64_t> m_ulSupersededFrames = 0;
+	std::atomic<bool> m_bFrameLost = false;
+};
+
 void SwapBuffers();
\ No newline at end of file
@@ -10,6 +10,7 @@
 #include <sys/system_properties.h>
 
 #include "main.h"
+#include "android.h"
 #include "log.h"
 #include "program.h"
 
@@ -87,7 +88,11 @@ void android_main(struct android_app *app) {
 
     Program program = Program(gApp, &g_app_state);
 
-    if (!program.BInit()) {
+    //the serial frame loop is there for comparing against, launch with --es frameLoop serial to get it
+    std::string sFrameLoop;
+    GetExtrasKey("frameLoop", sFrameLoop);
+
+    if (!program.BInit(sFrameLoop != "serial")) {
         Log(LogError, "[android_main] Failed to initialize openxr program. Aborting.");
         ANativeActivity_finish(app->activity);
         goto finish;
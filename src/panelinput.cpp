@@ -0,0 +1,346 @@
+#include "panelinput.h"
+
+#include <cmath>
+
+#include "log.h"
+#include "xrmath.h"
+
+#if defined( __ARM_NEON ) && defined( __aarch64__ )
+#include <arm_neon.h>
+#endif
+
+//rays this close to parallel with a quad never hit it
+static const float k_fParallelEpsilon = 1e-6f;
+
+static const float k_fTriggerPressThreshold = 0.6f;
+static const float k_fTriggerReleaseThreshold = 0.4f;
+
+//poke rays start this far behind the fingertip, so a finger pushed a little through a panel still hits it
+static const float k_fPokeRayBackoffMeters = 0.05f;
+
+void PanelQuadSet::Clear()
+{
+	m_unCount = 0;
+}
+
+int32_t PanelQuadSet::Add( const XrPosef &pose, float fWidthMeters, float fHeightMeters )
+{
+	//grow a block of four at a time, filled with quads that have no normal and so can't be hit
+	if ( m_unCount == m_vfCenterX.size())
+	{
+		for ( std::vector<float> *pvfLane: {&m_vfCenterX, &m_vfCenterY, &m_vfCenterZ, &m_vfRightX, &m_vfRightY,
+											 &m_vfRightZ, &m_vfUpX, &m_vfUpY, &m_vfUpZ, &m_vfNormalX, &m_vfNormalY,
+											 &m_vfNormalZ, &m_vfHalfWidth, &m_vfHalfHeight} )
+		{
+			pvfLane->resize( m_unCount + 4, 0.f );
+		}
+	}
+
+	const XrVector3f vecUnitX = {1.f, 0.f, 0.f};
+	const XrVector3f vecUnitY = {0.f, 1.f, 0.f};
+	const XrVector3f vecUnitZ = {0.f, 0.f, 1.f};
+
+	XrVector3f vecRight, vecUp, vecNormal;
+	XrQuaternionf_RotateVector3f( &vecRight, &pose.orientation, &vecUnitX );
+	XrQuaternionf_RotateVector3f( &vecUp, &pose.orientation, &vecUnitY );
+	XrQuaternionf_RotateVector3f( &vecNormal, &pose.orientation, &vecUnitZ );
+
+	const uint32_t i = m_unCount;
+	m_vfCenterX[ i ] = pose.position.x;
+	m_vfCenterY[ i ] = pose.position.y;
+	m_vfCenterZ[ i ] = pose.position.z;
+	m_vfRightX[ i ] = vecRight.x;
+	m_vfRightY[ i ] = vecRight.y;
+	m_vfRightZ[ i ] = vecRight.z;
+	m_vfUpX[ i ] = vecUp.x;
+	m_vfUpY[ i ] = vecUp.y;
+	m_vfUpZ[ i ] = vecUp.z;
+	m_vfNormalX[ i ] = vecNormal.x;
+	m_vfNormalY[ i ] = vecNormal.y;
+	m_vfNormalZ[ i ] = vecNormal.z;
+	m_vfHalfWidth[ i ] = 0.5f * fabsf( fWidthMeters );
+	m_vfHalfHeight[ i ] = 0.5f * fabsf( fHeightMeters );
+
+	return (int32_t) m_unCount++;
+}
+
+void PanelQuadSet::RayCastBlock( uint32_t unFirst, const XrVector3f &vecOrigin, const XrVector3f &vecDirection,
+								 float *pfDistance, float *pfU, float *pfV ) const
+{
+	//the ray is o + t * d and a quad's plane is dot(p - c, n) = 0, so t = dot(c - o, n) / dot(d, n).
+	//the hit relative to the centre is t * d - (c - o), which is projected onto the quad's axes
+#if defined( __ARM_NEON ) && defined( __aarch64__ )
+	const float32x4_t dx = vdupq_n_f32( vecDirection.x );
+	const float32x4_t dy = vdupq_n_f32( vecDirection.y );
+	const float32x4_t dz = vdupq_n_f32( vecDirection.z );
+
+	const float32x4_t nx = vld1q_f32( &m_vfNormalX[ unFirst ] );
+	const float32x4_t ny = vld1q_f32( &m_vfNormalY[ unFirst ] );
+	const float32x4_t nz = vld1q_f32( &m_vfNormalZ[ unFirst ] );
+
+	const float32x4_t wx = vsubq_f32( vld1q_f32( &m_vfCenterX[ unFirst ] ), vdupq_n_f32( vecOrigin.x ));
+	const float32x4_t wy = vsubq_f32( vld1q_f32( &m_vfCenterY[ unFirst ] ), vdupq_n_f32( vecOrigin.y ));
+	const float32x4_t wz = vsubq_f32( vld1q_f32( &m_vfCenterZ[ unFirst ] ), vdupq_n_f32( vecOrigin.z ));
+
+	const float32x4_t denom = vfmaq_f32( vfmaq_f32( vmulq_f32( dx, nx ), dy, ny ), dz, nz );
+	const float32x4_t num = vfmaq_f32( vfmaq_f32( vmulq_f32( wx, nx ), wy, ny ), wz, nz );
+	const float32x4_t t = vdivq_f32( num, denom );
+
+	const float32x4_t rx = vsubq_f32( vmulq_f32( t, dx ), wx );
+	const float32x4_t ry = vsubq_f32( vmulq_f32( t, dy ), wy );
+	const float32x4_t rz = vsubq_f32( vmulq_f32( t, dz ), wz );
+
+	const float32x4_t u = vfmaq_f32( vfmaq_f32( vmulq_f32( rx, vld1q_f32( &m_vfRightX[ unFirst ] )),
+												ry, vld1q_f32( &m_vfRightY[ unFirst ] )),
+									 rz, vld1q_f32( &m_vfRightZ[ unFirst ] ));
+	const float32x4_t v = vfmaq_f32( vfmaq_f32( vmulq_f32( rx, vld1q_f32( &m_vfUpX[ unFirst ] )),
+												ry, vld1q_f32( &m_vfUpY[ unFirst ] )),
+									 rz, vld1q_f32( &m_vfUpZ[ unFirst ] ));
+
+	uint32x4_t valid = vcagtq_f32( denom, vdupq_n_f32( k_fParallelEpsilon ));
+	valid = vandq_u32( valid, vcgtq_f32( t, vdupq_n_f32( 0.f )));
+	valid = vandq_u32( valid, vcaleq_f32( u, vld1q_f32( &m_vfHalfWidth[ unFirst ] )));
+	valid = vandq_u32( valid, vcaleq_f32( v, vld1q_f32( &m_vfHalfHeight[ unFirst ] )));
+
+	vst1q_f32( pfDistance, vbslq_f32( valid, t, vdupq_n_f32( INFINITY )));
+	vst1q_f32( pfU, u );
+	vst1q_f32( pfV, v );
+#else
+	for ( uint32_t unLane = 0; unLane < 4; unLane++ )
+	{
+		const uint32_t i = unFirst + unLane;
+
+		const float fDenom = vecDirection.x * m_vfNormalX[ i ] + vecDirection.y * m_vfNormalY[ i ] + vecDirection.z * m_vfNormalZ[ i ];
+
+		const float wx = m_vfCenterX[ i ] - vecOrigin.x;
+		const float wy = m_vfCenterY[ i ] - vecOrigin.y;
+		const float wz = m_vfCenterZ[ i ] - vecOrigin.z;
+
+		pfDistance[ unLane ] = INFINITY;
+		pfU[ unLane ] = 0.f;
+		pfV[ unLane ] = 0.f;
+		if ( fabsf( fDenom ) <= k_fParallelEpsilon )
+		{
+			continue;
+		}
+
+		const float t = ( wx * m_vfNormalX[ i ] + wy * m_vfNormalY[ i ] + wz * m_vfNormalZ[ i ] ) / fDenom;
+
+		const float rx = t * vecDirection.x - wx;
+		const float ry = t * vecDirection.y - wy;
+		const float rz = t * vecDirection.z - wz;
+
+		const float u = rx * m_vfRightX[ i ] + ry * m_vfRightY[ i ] + rz * m_vfRightZ[ i ];
+		const float v = rx * m_vfUpX[ i ] + ry * m_vfUpY[ i ] + rz * m_vfUpZ[ i ];
+
+		pfU[ unLane ] = u;
+		pfV[ unLane ] = v;
+		if ( t > 0.f && fabsf( u ) <= m_vfHalfWidth[ i ] && fabsf( v ) <= m_vfHalfHeight[ i ] )
+		{
+			pfDistance[ unLane ] = t;
+		}
+	}
+#endif
+}
+
+bool PanelQuadSet::BRayCast( const XrPosef &rayPose, PanelRayHit &outHit ) const
+{
+	outHit = {};
+
+	const XrVector3f vecForward = {0.f, 0.f, -1.f};
+	XrVector3f vecDirection;
+	XrQuaternionf_RotateVector3f( &vecDirection, &rayPose.orientation, &vecForward );
+
+	float fBestU = 0.f;
+	float fBestV = 0.f;
+	float fBestDistance = INFINITY;
+	for ( uint32_t unFirst = 0; unFirst < m_unCount; unFirst += 4 )
+	{
+		float afDistance[ 4 ], afU[ 4 ], afV[ 4 ];
+		RayCastBlock( unFirst, rayPose.position, vecDirection, afDistance, afU, afV );
+
+		//lanes past the count can hold quads from an earlier frame
+		for ( uint32_t unLane = 0; unLane < 4 && unFirst + unLane < m_unCount; unLane++ )
+		{
+			if ( afDistance[ unLane ] < fBestDistance )
+			{
+				fBestDistance = afDistance[ unLane ];
+				fBestU = afU[ unLane ];
+				fBestV = afV[ unLane ];
+				outHit.nQuad = (int32_t) ( unFirst + unLane );
+			}
+		}
+	}
+
+	if ( outHit.nQuad < 0 )
+	{
+		return false;
+	}
+
+	//the page's top left is at -x, +y of the quad
+	outHit.fDistance = fBestDistance;
+	outHit.fU = 0.5f + 0.5f * fBestU / m_vfHalfWidth[ outHit.nQuad ];
+	outHit.fV = 0.5f - 0.5f * fBestV / m_vfHalfHeight[ outHit.nQuad ];
+
+	XrVector3f vecOffset;
+	XrVector3f_Scale( &vecOffset, &vecDirection, fBestDistance );
+	XrVector3f_Add( &outHit.vecWorldHit, &rayPose.position, &vecOffset );
+
+	return true;
+}
+
+bool PanelInput::Init( XRQContext &xrqContext )
+{
+	if ( xrqContext.bIsHandTrackingSupported && !XRQCreateHandTrackers( xrqContext ))
+	{
+		Log( LogWarning, "[PanelInput] Failed to create hand trackers, only controllers can aim at panels" );
+	}
+
+	if ( xrqContext.bIsHandTrackingSetup )
+	{
+		m_gestureRecognizer.Start( xrqContext.handJoints );
+	}
+
+	XRQActionSetCreateInfo actionSetCreateInfo = {
+			.sActionSetName = "panel_input",
+			.sLocalizedActionSetName = "Panel Input",
+			.unPriority = 0,
+	};
+	if ( !XRQCreateAndRegisterActionSetForAttach( xrqContext, actionSetCreateInfo, m_actionSet ))
+	{
+		Log( LogError, "[PanelInput] Failed to create action set" );
+		return false;
+	}
+
+	XRQActionCreateInfo aimCreateInfo = {
+			.actionType = XR_ACTION_TYPE_POSE_INPUT,
+			.sActionName = "aim",
+			.subActionPathHand = XRQ_HAND_BOTH,
+			.mapInteractionProfileBindings = {
+					{"/interaction_profiles/oculus/touch_controller", {"/user/hand/left/input/aim/pose", "/user/hand/right/input/aim/pose"}},
+					{"/interaction_profiles/khr/simple_controller", {"/user/hand/left/input/aim/pose", "/user/hand/right/input/aim/pose"}},
+			},
+	};
+	if ( !XRQCreateActionAndRegisterSuggestedBindings( xrqContext, m_actionSet, aimCreateInfo, m_aimAction ))
+	{
+		Log( LogError, "[PanelInput] Failed to create aim action" );
+		return false;
+	}
+
+	XRQActionCreateInfo selectCreateInfo = {
+			.actionType = XR_ACTION_TYPE_FLOAT_INPUT,
+			.sActionName = "select",
+			.subActionPathHand = XRQ_HAND_BOTH,
+			.mapInteractionProfileBindings = {
+					{"/interaction_profiles/oculus/touch_controller", {"/user/hand/left/input/trigger/value", "/user/hand/right/input/trigger/value"}},
+					{"/interaction_profiles/khr/simple_controller", {"/user/hand/left/input/select/click", "/user/hand/right/input/select/click"}},
+			},
+	};
+	if ( !XRQCreateActionAndRegisterSuggestedBindings( xrqContext, m_actionSet, selectCreateInfo, m_selectAction ))
+	{
+		Log( LogError, "[PanelInput] Failed to create select action" );
+		return false;
+	}
+
+	XRQRegisterActionSetForSync( xrqContext, m_actionSet, XRQ_HAND_BOTH );
+
+	return true;
+}
+
+void PanelInput::LocateHands( XRQContext &xrqContext )
+{
+	XRQLocateHandJointsFrame( xrqContext );
+	m_gestureRecognizer.NotifyHandsLocated();
+}
+
+void PanelInput::Update( XRQContext &xrqContext )
+{
+	const bool bActionsSynced = m_actionSet != XR_NULL_HANDLE && XRQSyncRegisteredActiveActionSets( xrqContext );
+	const XrTime time = xrqContext.currentFrameState.predictedDisplayTime;
+	const XRQHandJointsSnapshot &handJoints = xrqContext.handJoints.GetLatest();
+
+	//usually the recognizer is done with this frame's hands by now, otherwise its events arrive a frame later
+	GestureEvent event;
+	while ( m_gestureRecognizer.BPopEvent( event ))
+	{
+		HandGestures &gestures = m_aHandGestures[ event.hand ];
+		const bool bActive = event.ePhase != GESTURE_PHASE_END;
+		switch ( event.eType )
+		{
+			case GESTURE_PINCH:
+				gestures.bPinching = bActive;
+				break;
+			case GESTURE_SCROLL:
+				gestures.bScrolling = bActive;
+				break;
+			case GESTURE_POKE:
+				gestures.bPoking = bActive;
+				gestures.pokePose = event.pose;
+				break;
+			case GESTURE_GRAB:
+				//a grab only selects once it moves and becomes a scroll
+				break;
+		}
+	}
+
+	for ( int i = 0; i < 2; i++ )
+	{
+		const XRQHand hand = (XRQHand) i;
+		PanelPointerRay &ray = m_aRays[ i ];
+		ray = {};
+
+		//a tracked hand wins over a controller that may still be lying around
+		const XRQHandJoints &handState = handJoints.aHands[ i ];
+		const HandGestures &gestures = m_aHandGestures[ i ];
+		if ( handState.bIsActive && gestures.bPoking )
+		{
+			XrVector3f vecFingerDirection;
+			XrQuaternionf_RotateVector3f( &vecFingerDirection, &gestures.pokePose.orientation, &k_vecForward );
+
+			ray.bValid = true;
+			ray.pose = gestures.pokePose;
+			ray.pose.position.x -= vecFingerDirection.x * k_fPokeRayBackoffMeters;
+			ray.pose.position.y -= vecFingerDirection.y * k_fPokeRayBackoffMeters;
+			ray.pose.position.z -= vecFingerDirection.z * k_fPokeRayBackoffMeters;
+			ray.fTouchDistance = k_fPokeRayBackoffMeters;
+			m_abTriggerPressed[ i ] = false;
+			continue;
+		}
+
+		if ( handState.bIsAimValid )
+		{
+			ray.bValid = true;
+			ray.pose = handState.aimState.aimPose;
+			ray.bSelecting = gestures.bPinching || gestures.bScrolling;
+			m_abTriggerPressed[ i ] = false;
+			continue;
+		}
+
+		XrSpaceLocation aimLocation = {
+				.type = XR_TYPE_SPACE_LOCATION,
+				.next = nullptr,
+		};
+		if ( !bActionsSynced || !XRQLocateActionSpace( xrqContext, m_aimAction, hand, time, aimLocation ) ||
+			 !XRQIsLocationValid( aimLocation.locationFlags ))
+		{
+			m_abTriggerPressed[ i ] = false;
+			continue;
+		}
+
+		ray.bValid = true;
+		ray.pose = aimLocation.pose;
+
+		XrActionStateFloat selectState;
+		if ( XRQGetActionStateFloat( xrqContext, m_selectAction, hand, selectState ) && selectState.isActive )
+		{
+			const float fThreshold = m_abTriggerPressed[ i ] ? k_fTriggerReleaseThreshold : k_fTriggerPressThreshold;
+			m_abTriggerPressed[ i ] = selectState.currentState > fThreshold;
+		}
+		else
+		{
+			m_abTriggerPressed[ i ] = false;
+		}
+
+		ray.bSelecting = m_abTriggerPressed[ i ];
+	}
+}
\ No newline at end of file
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "gesturerecognizer.h"
+#include "xrq.h"
+
+struct PanelPointerRay
+{
+	bool bValid = false;
+
+	//the ray starts at the pose and points down its -Z axis
+	XrPosef pose{};
+
+	bool bSelecting = false;
+
+	//set for rays cast from behind a fingertip, which select by touching what they hit rather than by bSelecting.
+	//The ray starts this far behind the fingertip
+	float fTouchDistance = 0.f;
+};
+
+struct PanelRayHit
+{
+	//index the quad was added at, -1 if nothing was hit
+	int32_t nQuad = -1;
+
+	float fDistance = 0.f;
+
+	//0,0 is the top left of the quad as the page is shown on it
+	float fU = 0.f;
+	float fV = 0.f;
+
+	XrVector3f vecWorldHit{};
+};
+
+// Quads stored as structure of arrays, so a ray is tested against four of them at a time.
+// Filled once per frame from the panels' poses and shared by every ray cast that frame.
+class PanelQuadSet
+{
+public:
+	void Clear();
+
+	//returns the index the quad can be found at in hits
+	int32_t Add( const XrPosef &pose, float fWidthMeters, float fHeightMeters );
+
+	//nearest quad the ray hits from either side, false if it misses all of them
+	bool BRayCast( const XrPosef &rayPose, PanelRayHit &outHit ) const;
+
+	uint32_t GetCount() const { return m_unCount; }
+
+private:
+	//writes the distance to four quads starting at unFirst, infinite for misses, and where on them the ray hit
+	void RayCastBlock( uint32_t unFirst, const XrVector3f &vecOrigin, const XrVector3f &vecDirection,
+					   float *pfDistance, float *pfU, float *pfV ) const;
+
+	uint32_t m_unCount = 0;
+
+	//padded to a multiple of four with quads that can't be hit
+	std::vector<float> m_vfCenterX, m_vfCenterY, m_vfCenterZ;
+	std::vector<float> m_vfRightX, m_vfRightY, m_vfRightZ;
+	std::vector<float> m_vfUpX, m_vfUpY, m_vfUpZ;
+	std::vector<float> m_vfNormalX, m_vfNormalY, m_vfNormalZ;
+	std::vector<float> m_vfHalfWidth, m_vfHalfHeight;
+};
+
+// Produces one aim ray per hand every frame. Tracked hands poke with their index finger while pointing, otherwise
+// they aim with XR_FB_hand_tracking_aim and select by pinching or by grabbing and dragging. Controllers aim with
+// their aim pose and select with the trigger.
+class PanelInput
+{
+public:
+	//registers the controller actions for attach, so call before XRQAttachRegisteredActionSets
+	bool Init( XRQContext &xrqContext );
+
+	//locates the hands for the frame and hands them to gesture recognition, call early so that overlaps with the frame
+	void LocateHands( XRQContext &xrqContext );
+
+	//takes the gestures recognized so far, controllers are located at the frame's predicted display time
+	void Update( XRQContext &xrqContext );
+
+	const std::array<PanelPointerRay, 2> &GetRays() const { return m_aRays; }
+
+private:
+	XrActionSet m_actionSet = XR_NULL_HANDLE;
+	XRQAction m_aimAction;
+	XRQAction m_selectAction;
+
+	//the trigger has to cross different thresholds to press and release, so a resting finger doesn't chatter
+	std::array<bool, 2> m_abTriggerPressed = {false, false};
+
+	GestureRecognizer m_gestureRecognizer;
+
+	struct HandGestures
+	{
+		bool bPinching = false;
+		bool bScrolling = false;
+		bool bPoking = false;
+		XrPosef pokePose{};
+	};
+
+	std::array<HandGestures, 2> m_aHandGestures;
+
+	std::array<PanelPointerRay, 2> m_aRays;
+};
\ No newline at end of file
@@ -0,0 +1,366 @@
+#include "panelmanager.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "log.h"
+#include "timeutils.h"
+
+//a culled panel comes back while still this far outside the views, so it has fresh content by the time it is seen
+static const float k_fCullEnterMarginDegrees = 10.f;
+
+//and a visible panel has to get this far outside before it is culled again, so it doesn't flicker at the edge
+static const float k_fCullExitMarginDegrees = 20.f;
+
+//the focused panel has to be within this cone
+static const float k_fFocusHalfAngleDegrees = 20.f;
+
+//gaze samples the runtime is less sure of than this are treated like a blink
+static const float k_fMinGazeConfidence = 0.5f;
+
+//how long the gaze result survives the eyes not being tracked or looking past every panel
+static const uint64_t k_ulGazeHoldUS = 300000;
+
+//panels the user isn't looking at draw at most every this many frame times, at this fraction of the resolution
+static const uint32_t k_unPeripheralDrawFrameTimes = 3;
+static const float k_fPeripheralDetailScale = 0.5f;
+
+//a fingertip hovers the panel it is about to touch once it gets this close
+static const float k_fTouchHoverMeters = 0.1f;
+
+static const uint32_t k_unScheduleStatsLogIntervalFrames = 600;
+
+static const uint32_t k_unAtlasSize = 2048;
+
+PanelManager::PanelManager(uint64_t ulUIThreadBudgetUS) : m_ulUIThreadBudgetUS(ulUIThreadBudgetUS) {
+}
+
+XrUIPanel *PanelManager::AddPanel(const XRQContext &xrqContext, std::unique_ptr<XrUIPanel> pPanel) {
+    if (pPanel->GetPanelConfig().bPackIntoAtlas && !m_pAtlas) {
+        XRQSwapchainInfo atlasInfo = {
+                .width = k_unAtlasSize,
+                .height = k_unAtlasSize,
+                .recommendedFormat = GL_SRGB8_ALPHA8,
+                .sampleCount = xrqContext.vViewConfigViews[0].recommendedSwapchainSampleCount,
+        };
+
+        m_pAtlas = std::make_unique<XRQSwapchainAtlas>();
+        if (!XRQCreateSwapchainAtlas(xrqContext, atlasInfo, *m_pAtlas)) {
+            Log(LogError, "[PanelManager] Failed to create swapchain atlas, panels will get their own swapchains");
+            m_pAtlas = nullptr;
+        }
+    }
+
+    //a panel that doesn't fit into the atlas still works with a swapchain of its own
+    const bool bPackedIntoAtlas = pPanel->GetPanelConfig().bPackIntoAtlas && m_pAtlas && pPanel->Init(xrqContext, m_pAtlas.get());
+    if (!bPackedIntoAtlas && !pPanel->Init(xrqContext)) {
+        Log(LogError, "[PanelManager] Failed to initialize panel %zu", m_vPanels.size());
+        return nullptr;
+    }
+
+    m_vPanels.push_back({.pPanel = std::move(pPanel)});
+    m_vDrawCandidates.reserve(m_vPanels.size());
+
+    //can't be hit until the next PrepareFrame puts it into the quads
+    m_vnPanelQuads.push_back(-1);
+
+    Log("[PanelManager] Added panel %zu", m_vPanels.size() - 1);
+    return m_vPanels.back().pPanel.get();
+}
+
+void PanelManager::DispatchInput(const std::array<PanelPointerRay, 2> &rays) {
+    std::array<PanelRayHit, 2> aHits;
+    std::array<bool, 2> abSelecting;
+    for (int i = 0; i < 2; i++) {
+        const bool bIsTouch = rays[i].fTouchDistance > 0.f;
+        if (!rays[i].bValid || !m_panelQuads.BRayCast(rays[i].pose, aHits[i]) ||
+            (bIsTouch && aHits[i].fDistance > rays[i].fTouchDistance + k_fTouchHoverMeters)) {
+            aHits[i] = {};
+        }
+
+        //a touch selects as long as the fingertip is on or through the panel it points at
+        abSelecting[i] = rays[i].bValid && (bIsTouch ? aHits[i].nQuad >= 0 && aHits[i].fDistance <= rays[i].fTouchDistance
+                                                     : rays[i].bSelecting);
+    }
+
+    //every panel gets its states, so one the pointer left or that got culled mid press still sees the release
+    for (size_t i = 0; i < m_vPanels.size(); i++) {
+        std::array<XrUIPanelHandInteractionState, 2> handStates{};
+        for (int j = 0; j < 2; j++) {
+            handStates[j].bIsSelecting = abSelecting[j];
+            if (m_vnPanelQuads[i] >= 0 && aHits[j].nQuad == m_vnPanelQuads[i]) {
+                handStates[j].bRayIntersects = true;
+                handStates[j].vecIntersection = {aHits[j].fU, aHits[j].fV};
+                handStates[j].vecWorldIntersection = aHits[j].vecWorldHit;
+            }
+        }
+
+        m_vPanels[i].pPanel->UpdateInput(handStates);
+    }
+}
+
+void PanelManager::LateLatchPoses(XRQContext &xrqContext) {
+    //the prediction for the same display time gets better the later it is asked for
+    XrSpaceLocation viewSpaceLocation = {
+            .type = XR_TYPE_SPACE_LOCATION,
+            .next = nullptr,
+    };
+    if (!XRQLocateReferenceSpaceAtFrameTime(xrqContext, XR_REFERENCE_SPACE_TYPE_VIEW, viewSpaceLocation) ||
+        !XRQIsLocationValid(viewSpaceLocation.locationFlags)) {
+        //keep the poses from earlier in the frame
+        return;
+    }
+
+    for (PanelState &state: m_vPanels) {
+        if (state.bVisible) {
+            state.pPanel->LateLatchPose(viewSpaceLocation.pose);
+        }
+    }
+}
+
+XrUIPanel *PanelManager::GetFocusedPanel() const {
+    return m_nFocusedPanel >= 0 ? m_vPanels[m_nFocusedPanel].pPanel.get() : nullptr;
+}
+
+void PanelManager::UpdateVisibility(const XRQContext &xrqContext, const XrPosef &headPose) {
+    const XrVector3f vecForward = {0.f, 0.f, -1.f};
+    XrVector3f vecHeadForward;
+    XrQuaternionf_RotateVector3f(&vecHeadForward, &headPose.orientation, &vecForward);
+
+    m_nFocusedPanel = -1;
+    float fFocusedAngleDegrees = k_fFocusHalfAngleDegrees;
+
+    for (size_t i = 0; i < m_vPanels.size(); i++) {
+        PanelState &state = m_vPanels[i];
+
+        state.bVisible = state.pPanel->BIsInView(xrqContext, state.bVisible ? k_fCullExitMarginDegrees : k_fCullEnterMarginDegrees);
+        if (!state.bVisible) {
+            m_unStatsCulledPanels++;
+            continue;
+        }
+
+        XrVector3f vecToPanel;
+        XrVector3f_Sub(&vecToPanel, &state.pPanel->GetPose().position, &headPose.position);
+        const float fDistance = XrVector3f_Length(&vecToPanel);
+        if (fDistance < 0.01f) {
+            //not positioned yet, or the head is inside it
+            state.fAngleDegrees = 0.f;
+            continue;
+        }
+
+        XrVector3f_Scale(&vecToPanel, &vecToPanel, 1.f / fDistance);
+        const float fCosAngle = std::clamp(XrVector3f_Dot(&vecHeadForward, &vecToPanel), -1.f, 1.f);
+        state.fAngleDegrees = acosf(fCosAngle) * 180.f / (float) M_PI;
+
+        if (state.fAngleDegrees < fFocusedAngleDegrees) {
+            fFocusedAngleDegrees = state.fAngleDegrees;
+            m_nFocusedPanel = (int32_t) i;
+        }
+    }
+}
+
+void PanelManager::BuildPanelQuads() {
+    //culled panels can't be pointed or looked at, visible ones also block the rays to panels behind them
+    m_panelQuads.Clear();
+    m_vnPanelQuads.resize(m_vPanels.size());
+    for (size_t i = 0; i < m_vPanels.size(); i++) {
+        XrUIPanel &panel = *m_vPanels[i].pPanel;
+        m_vnPanelQuads[i] = m_vPanels[i].bVisible
+                            ? m_panelQuads.Add(panel.GetPose(), panel.GetPanelConfig().fWidthMeters, panel.GetPanelConfig().fHeightMeters)
+                            : -1;
+    }
+}
+
+void PanelManager::UpdateGaze(const XRQContext &xrqContext, uint64_t ulTimeNowUS) {
+    XrPosef gazePose;
+    float fConfidence = 0.f;
+    if (!XRQLocateEyeGaze(xrqContext, xrqContext.currentFrameState.predictedDisplayTime, gazePose, fConfidence) ||
+        fConfidence < k_fMinGazeConfidence) {
+        if (m_bIsGazeTracked && ulTimeNowUS - m_ulGazeTrackedTimeUS > k_ulGazeHoldUS) {
+            Log("[PanelManager] Lost eye gaze, focusing on where the head points");
+            m_bIsGazeTracked = false;
+            m_nGazedPanel = -1;
+        }
+    } else {
+        if (!m_bIsGazeTracked) {
+            Log("[PanelManager] Tracking eye gaze, peripheral panels are throttled");
+        }
+        m_bIsGazeTracked = true;
+        m_ulGazeTrackedTimeUS = ulTimeNowUS;
+
+        //looking at another panel moves focus straight away, looking away from all of them only after a while
+        PanelRayHit hit;
+        int32_t nHitPanel = -1;
+        if (m_panelQuads.BRayCast(gazePose, hit)) {
+            auto it = std::find(m_vnPanelQuads.begin(), m_vnPanelQuads.end(), hit.nQuad);
+            nHitPanel = it != m_vnPanelQuads.end() ? (int32_t) (it - m_vnPanelQuads.begin()) : -1;
+        }
+
+        if (nHitPanel >= 0) {
+            m_nGazedPanel = nHitPanel;
+            m_ulGazeHitTimeUS = ulTimeNowUS;
+        } else if (ulTimeNowUS - m_ulGazeHitTimeUS > k_ulGazeHoldUS) {
+            m_nGazedPanel = -1;
+        }
+    }
+
+    if (m_bIsGazeTracked) {
+        m_nFocusedPanel = m_nGazedPanel;
+        m_unStatsGazeTrackedFrames++;
+    }
+}
+
+void PanelManager::ScheduleDraws(uint64_t ulTimeNowUS) {
+    //draws still waiting on the UI thread from earlier frames eat into this frame's budget
+    uint64_t ulPendingCostUS = 0;
+    m_vDrawCandidates.clear();
+
+    for (size_t i = 0; i < m_vPanels.size(); i++) {
+        PanelState &state = m_vPanels[i];
+        XrUIPanel &panel = *state.pPanel;
+
+        if (panel.m_pWebView->BIsDrawPending()) {
+            ulPendingCostUS += panel.m_pWebView->GetDrawCostEstimateUS();
+            continue;
+        }
+
+        //culled panels aren't rasterized at all, and peripheral ones at a fraction of their rate
+        if (!state.bVisible || !panel.BIsDrawDue(ulTimeNowUS, BIsPeripheral((int32_t) i) ? k_unPeripheralDrawFrameTimes : 1)) {
+            continue;
+        }
+
+        //how many frame times the panel is overdue, grows every frame it is deferred
+        const float fOverdue = std::min((float) (ulTimeNowUS - panel.GetLastDrawRequestTimeUS()) /
+                                        (float) panel.GetFrameTimeUS(), 4.f);
+        const float fWeight = (int32_t) i == m_nFocusedPanel ? 2.f : 1.f;
+
+        state.fPriority = fWeight * fOverdue + (1.f - state.fAngleDegrees / 180.f);
+        m_vDrawCandidates.push_back(&state);
+    }
+
+    std::sort(m_vDrawCandidates.begin(), m_vDrawCandidates.end(), [](const PanelState *a, const PanelState *b) {
+        return a->fPriority > b->fPriority;
+    });
+
+    uint64_t ulSpentUS = ulPendingCostUS;
+    bool bScheduledAny = false;
+    for (PanelState *pState: m_vDrawCandidates) {
+        const uint64_t ulCostUS = pState->pPanel->m_pWebView->GetDrawCostEstimateUS();
+
+        //a single draw over budget still goes ahead when the UI thread is otherwise idle, later ones wait
+        if (ulSpentUS + ulCostUS > m_ulUIThreadBudgetUS && (bScheduledAny || ulPendingCostUS > 0)) {
+            m_unStatsDeferredDraws++;
+            continue;
+        }
+
+        pState->pPanel->RequestDraw(ulTimeNowUS);
+        ulSpentUS += ulCostUS;
+        bScheduledAny = true;
+        m_unStatsScheduledDraws++;
+    }
+}
+
+void PanelManager::AcquireAtlasImage(XRQFrameSwapchainScheduler &swapchainScheduler) {
+    m_nAcquiredAtlasImage = -1;
+    if (!m_pAtlas) {
+        return;
+    }
+
+    bool bAnyNewContent = false;
+    for (const PanelState &state: m_vPanels) {
+        if (state.pPanel->BUsesAtlas() && state.pPanel->BHasNewContent()) {
+            bAnyNewContent = true;
+            break;
+        }
+    }
+
+    if (!bAnyNewContent) {
+        //the compositor keeps showing the last released image for all of them
+        return;
+    }
+
+    m_nAcquiredAtlasImage = swapchainScheduler.Acquire(m_pAtlas->swapchain, "atlas");
+}
+
+bool PanelManager::UpdateAtlas(XRQFrameSwapchainScheduler &swapchainScheduler) {
+    if (m_nAcquiredAtlasImage < 0) {
+        return true;
+    }
+
+    GLuint atlasTexture = swapchainScheduler.WaitForImage(m_nAcquiredAtlasImage);
+    m_nAcquiredAtlasImage = -1;
+    if (atlasTexture == 0) {
+        return false;
+    }
+
+    for (PanelState &state: m_vPanels) {
+        if (state.pPanel->BUsesAtlas()) {
+            state.pPanel->CopyToAtlas(atlasTexture);
+        }
+    }
+
+    m_unStatsAtlasAcquires++;
+    return true;
+}
+
+void PanelManager::PrepareFrame(XRQContext &xrqContext, XRQFrameSwapchainScheduler &swapchainScheduler) {
+    XrSpaceLocation viewSpaceLocation = {
+            .type = XR_TYPE_SPACE_LOCATION,
+            .next = nullptr,
+    };
+    XRQLocateReferenceSpaceAtFrameTime(xrqContext, XR_REFERENCE_SPACE_TYPE_VIEW, viewSpaceLocation);
+
+    for (PanelState &state: m_vPanels) {
+        state.pPanel->Update(xrqContext);
+    }
+
+    const uint64_t ulTimeNowUS = GetCurrentTimeUS();
+    UpdateVisibility(xrqContext, viewSpaceLocation.pose);
+    BuildPanelQuads();
+    UpdateGaze(xrqContext, ulTimeNowUS);
+
+    for (size_t i = 0; i < m_vPanels.size(); i++) {
+        if (m_vPanels[i].bVisible) {
+            m_vPanels[i].pPanel->UpdateRenderScale(xrqContext, BIsPeripheral((int32_t) i) ? k_fPeripheralDetailScale : 1.f);
+        }
+    }
+
+    ScheduleDraws(ulTimeNowUS);
+
+    //culled panels aren't submitted, so there is no point acquiring their images
+    AcquireAtlasImage(swapchainScheduler);
+    for (PanelState &state: m_vPanels) {
+        if (state.bVisible) {
+            state.pPanel->AcquireImage(swapchainScheduler);
+        }
+    }
+}
+
+void PanelManager::RenderFrame(XRQContext &xrqContext, XRQFrameSwapchainScheduler &swapchainScheduler,
+                               std::vector<XrCompositionLayerBaseHeader *> &vLayers) {
+    //the atlas panels keep their content pending and are left out for a frame the compositor didn't hand it back in
+    const bool bAtlasUpdated = UpdateAtlas(swapchainScheduler);
+
+    //culled panels skip the upload and aren't submitted, the compositor has nothing to do for them either
+    for (PanelState &state: m_vPanels) {
+        if (!state.bVisible || (!bAtlasUpdated && state.pPanel->BUsesAtlas())) {
+            continue;
+        }
+
+        if (XrCompositionLayerBaseHeader *pLayer = state.pPanel->RenderFrame(xrqContext, swapchainScheduler)) {
+            vLayers.push_back(pLayer);
+        }
+    }
+
+    if (++m_unStatsFrames == k_unScheduleStatsLogIntervalFrames) {
+        Log("[PanelManager] %u panels, %u draws scheduled, %u deferred, %u panel frames culled, %u atlas acquires and %u gaze tracked frames over the last %u frames",
+            (uint32_t) m_vPanels.size(), m_unStatsScheduledDraws, m_unStatsDeferredDraws, m_unStatsCulledPanels,
+            m_unStatsAtlasAcquires, m_unStatsGazeTrackedFrames, m_unStatsFrames);
+        m_unStatsFrames = 0;
+        m_unStatsScheduledDraws = 0;
+        m_unStatsDeferredDraws = 0;
+        m_unStatsCulledPanels = 0;
+        m_unStatsAtlasAcquires = 0;
+        m_unStatsGazeTrackedFrames = 0;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "xrq.h"
+#include "xruipanel.h"
+#include "panelinput.h"
+
+// Owns every panel and decides each frame which of them get to draw.
+// All webviews draw on the one Android UI thread, so draws are handed out in priority order (focused, visible,
+// closest to where the head points, most overdue) until their estimated cost would overrun the frame's budget.
+// Panels that miss out are more overdue next frame, so nothing starves. Panels outside every view are culled:
+// they are neither drawn, uploaded nor submitted.
+// With eye tracking the panel being looked at is the focused one, and only it draws at its full rate and resolution.
+// Panels configured with bPackIntoAtlas share one atlas swapchain, which is acquired at most once a frame.
+// A frame is split into PrepareFrame and RenderFrame so the swapchain waits can overlap the caller's own work.
+class PanelManager
+{
+public:
+	static constexpr uint64_t k_ulDefaultUIThreadBudgetUS = 6000;
+
+	explicit PanelManager( uint64_t ulUIThreadBudgetUS = k_ulDefaultUIThreadBudgetUS );
+
+	//returns nullptr if the panel failed to initialize
+	XrUIPanel *AddPanel( const XRQContext &xrqContext, std::unique_ptr<XrUIPanel> pPanel );
+
+	//positions, culls and schedules this frame's draws, then acquires the swapchain images that get new content.
+	//the caller can do its own work before RenderFrame while the compositor finishes with those images
+	void PrepareFrame( XRQContext &xrqContext, XRQFrameSwapchainScheduler &swapchainScheduler );
+
+	//copies new content into the images acquired by PrepareFrame and appends the layer of every panel that has
+	//something to show. The images are released by the scheduler
+	void RenderFrame( XRQContext &xrqContext, XRQFrameSwapchainScheduler &swapchainScheduler,
+					  std::vector<XrCompositionLayerBaseHeader *> &vLayers );
+
+	//casts each hand's ray once against every visible panel and hands the hits to the panels as pointer input.
+	//call after PrepareFrame, so the rays are tested against this frame's panel poses
+	void DispatchInput( const std::array<PanelPointerRay, 2> &rays );
+
+	//positions the submitted panels again from a freshly located head pose, call right before xrEndFrame
+	void LateLatchPoses( XRQContext &xrqContext );
+
+	//panel being looked at if the eyes are tracked, otherwise the one closest to the centre of view. nullptr if none is
+	//close enough
+	XrUIPanel *GetFocusedPanel() const;
+
+private:
+	struct PanelState
+	{
+		std::unique_ptr<XrUIPanel> pPanel;
+
+		//not culled, with hysteresis between the margins a panel enters and leaves the views at
+		bool bVisible = true;
+
+		//angle between the head's forward direction and the direction to the panel
+		float fAngleDegrees = 0.f;
+
+		float fPriority = 0.f;
+	};
+
+	void UpdateVisibility( const XRQContext &xrqContext, const XrPosef &headPose );
+
+	//fills the quads every ray cast against the visible panels uses this frame
+	void BuildPanelQuads();
+
+	//casts the gaze against the visible panels and moves focus to the one looked at
+	void UpdateGaze( const XRQContext &xrqContext, uint64_t ulTimeNowUS );
+
+	//only while the eyes are tracked, any panel but the one looked at
+	bool BIsPeripheral( int32_t nPanel ) const { return m_bIsGazeTracked && nPanel != m_nGazedPanel; }
+
+	void ScheduleDraws( uint64_t ulTimeNowUS );
+
+	//acquires the atlas image if any atlas panel has new content
+	void AcquireAtlasImage( XRQFrameSwapchainScheduler &swapchainScheduler );
+
+	//refreshes every atlas panel in the image acquired by AcquireAtlasImage, false if the image couldn't be waited on
+	bool UpdateAtlas( XRQFrameSwapchainScheduler &swapchainScheduler );
+
+	uint64_t m_ulUIThreadBudgetUS;
+
+	//created with the first panel that asks for it, outlives the panels holding rects in it
+	std::unique_ptr<XRQSwapchainAtlas> m_pAtlas;
+	int32_t m_nAcquiredAtlasImage = -1;
+
+	std::vector<PanelState> m_vPanels;
+	int32_t m_nFocusedPanel = -1;
+
+	//the gaze result is held through blinks and brief glances off a panel
+	bool m_bIsGazeTracked = false;
+	int32_t m_nGazedPanel = -1;
+	uint64_t m_ulGazeTrackedTimeUS = 0;
+	uint64_t m_ulGazeHitTimeUS = 0;
+
+	//reused every frame so scheduling doesn't allocate
+	std::vector<PanelState *> m_vDrawCandidates;
+
+	//visible panels as quads for ray casting, and the quad of every panel, -1 for culled ones
+	PanelQuadSet m_panelQuads;
+	std::vector<int32_t> m_vnPanelQuads;
+
+	uint32_t m_unStatsFrames = 0;
+	uint32_t m_unStatsScheduledDraws = 0;
+	uint32_t m_unStatsDeferredDraws = 0;
+	uint32_t m_unStatsCulledPanels = 0;
+	uint32_t m_unStatsAtlasAcquires = 0;
+	uint32_t m_unStatsGazeTrackedFrames = 0;
+};
\ No newline at end of file
@@ -11,11 +11,21 @@
 #include "openxr/openxr.h"
 #include "openxr/openxr_platform.h"
 
+#include "android.h"
 #include "log.h"
+#include "timeutils.h"
 #include "webview.h"
-#include "xruipanel.h"
+#include "panelmanager.h"
 #include "check.h"
 
+//how long a tick waits for the pacing thread before going back to polling the looper
+static const uint64_t k_ulFrameTakeTimeoutUS = 100000;
+
+static const char *const k_sEyeTrackingPermission = "com.oculus.permission.EYE_TRACKING";
+
+//the prompt's outcome has no callback without java code, so the grant is polled for this often
+static const uint64_t k_ulPermissionPollIntervalUS = 1000000;
+
 EGLDisplay egl_display;
 EGLSurface egl_surface;
 EGLContext egl_context;
@@ -25,7 +35,9 @@ Program::Program(android_app *pApp, app_state *pAppState) {
 
 }
 
-bool Program::BInit() {
+bool Program::BInit(bool bPipelinedFrameLoop) {
+    m_bPipelinedFrameLoop = bPipelinedFrameLoop;
+    Log("[Program] Using the %s frame loop", m_bPipelinedFrameLoop ? "pipelined" : "serial");
 
     EGLint egl_major, egl_minor;
 
@@ -156,6 +168,21 @@ bool Program::BInit() {
         return false;
     }
 
+    //gaze only picks the focused panel once eye tracking is granted, panels follow the head direction until then
+    if (m_xrqContext.bIsSocialEyeTrackingSupported) {
+        if (BHasPermission(k_sEyeTrackingPermission)) {
+            if (!XRQCreateEyeTracker(m_xrqContext)) {
+                Log(LogWarning, "[XrProgram] Failed to create eye tracker");
+            }
+        } else {
+            RequestPermission(k_sEyeTrackingPermission);
+            m_bAwaitingEyeTrackingPermission = true;
+        }
+    }
+
+    //this thread begins, renders and ends every frame
+    XRQSetApplicationThread(m_xrqContext, XR_ANDROID_THREAD_TYPE_RENDERER_MAIN_KHR);
+
     if (!XRQSetReferencePlaySpace(m_xrqContext, XR_REFERENCE_SPACE_TYPE_STAGE)) {
         Log(LogError, "[XrProgram] Failed to set play space");
 
@@ -178,30 +205,43 @@ bool Program::BInit() {
                                      m_vProjectionViews[i]);
     }
 
-    std::shared_ptr<WebView> pWebview = WebView::Create(
-            1280, 800,
-            "file:///android_asset/webview.html");
-
     PanelConfig panelConfig = {
             .fWidthMeters = 1.6f,
             .fHeightMeters = 1.f,
             .unTextureWidth = 1280,
             .unTextureHeight = 800,
-            .fRefreshRate = 120.f
+            .fRefreshRate = 120.f,
+            .eCaptureMode = WEBVIEW_CAPTURE_MODE_SURFACE_TEXTURE,
     };
+
+    std::shared_ptr<WebView> pWebview = WebView::Create(
+            panelConfig.unTextureWidth, panelConfig.unTextureHeight,
+            "file:///android_asset/webview.html",
+            panelConfig.eCaptureMode);
+
+    pWebview->RegisterMailboxHandler("log", [](std::string_view sData) {
+        Log("[WebView] Page: %.*s", (int) sData.size(), sData.data());
+    });
     std::unique_ptr<IPanelPositioner> pPanelPositioner = std::make_unique<PanelPositionerSlowTurnFromHead>(1.5f);
-    m_pUIPanel = std::make_unique<XrUIPanel>(
+    std::unique_ptr<XrUIPanel> pUIPanel = std::make_unique<XrUIPanel>(
             panelConfig,
             std::move(pWebview),
             std::move(pPanelPositioner)
     );
 
-    if (m_pUIPanel->Init(m_xrqContext)) {
+    if (m_panelManager.AddPanel(m_xrqContext, std::move(pUIPanel))) {
         Log("[XrProgram] initialized animation panel");
     } else {
         Log(LogError, "[XrProgram] failed to initialize stream animation panel. Not displaying.");
     }
 
+    //actions have to be registered before the action sets are attached, which can only happen once per session
+    if (!m_panelInput.Init(m_xrqContext)) {
+        Log(LogError, "[XrProgram] Failed to set up panel input, panels won't react to hands or controllers");
+    }
+    XRQSuggestRegisteredInteractionProfileBindings(m_xrqContext);
+    XRQAttachRegisteredActionSets(m_xrqContext);
+
     m_layerProjection = {
             .type = XR_TYPE_COMPOSITION_LAYER_PROJECTION,
             .next = nullptr,
@@ -216,45 +256,115 @@ bool Program::BInit() {
 }
 
 void Program::Tick() {
+    //the pacing thread is idle from a frame being taken until it has begun, so handling events can't race it
+    const bool bFramePacerRunning = m_framePacer.BIsRunning();
+    if (bFramePacerRunning && !m_framePacer.BTakeFrame(m_xrqContext, k_ulFrameTakeTimeoutUS)) {
+        return;
+    }
+
     XRQHandleEvents(m_xrqContext);
+    PollEyeTrackingPermission();
+
+    if (!m_xrqContext.bAppShouldSubmitFrames) {
+        //the waited frame is dropped, a new pacing thread starts with the next session
+        m_framePacer.Stop();
+        return;
+    }
+
+    if (!bFramePacerRunning) {
+        if (m_bPipelinedFrameLoop) {
+            m_framePacer.Start(m_xrqContext);
+            return;
+        }
 
-    if (m_xrqContext.bAppShouldSubmitFrames) {
         XRQWaitFrame(m_xrqContext);
+    }
 
-        XrFrameBeginInfo frame_begin_info = {.type = XR_TYPE_FRAME_BEGIN_INFO, .next = nullptr};
-        QUALIFY_XR_VOID(m_xrqContext.instance, xrBeginFrame(m_xrqContext.session, &frame_begin_info));
+    XrFrameBeginInfo frame_begin_info = {.type = XR_TYPE_FRAME_BEGIN_INFO, .next = nullptr};
+    XrResult frameBeginResult = xrBeginFrame(m_xrqContext.session, &frame_begin_info);
 
-        XRQLocateViewsFrame(m_xrqContext);
+    //from here on the pacing thread waits on the next frame while this one is rendered and submitted
+    m_framePacer.FrameBegun();
+    QUALIFY_XR_VOID(m_xrqContext.instance, frameBeginResult);
 
-        for (int i = 0; i < 2; i++) {
-            XRQAcquireSwapchainImageRAII constructImageIndex(m_projectionSwapchains[i]);
-            GLuint unSwapchainTexture = m_projectionSwapchains[i].images[constructImageIndex.GetAcquiredImageIndex()].image;
+    XRQLocateViewsFrame(m_xrqContext);
+    m_panelInput.LocateHands(m_xrqContext);
 
-            GL_CHECK(glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer));
-            GL_CHECK(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, unSwapchainTexture, 0));
+    //acquire everything the frame writes up front, the waits then overlap with the panels' CPU work
+    static const char *const k_asEyeSwapchainNames[2] = {"left eye", "right eye"};
+    int32_t anEyeImages[2];
+    for (int i = 0; i < 2; i++) {
+        anEyeImages[i] = m_swapchainScheduler.Acquire(m_projectionSwapchains[i], k_asEyeSwapchainNames[i]);
+    }
 
-            GL_CHECK(glClearColor(.5f, .5f, .5f, 1.f));
-            GL_CHECK(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
+    m_panelManager.PrepareFrame(m_xrqContext, m_swapchainScheduler);
 
-            GL_CHECK(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+    m_panelInput.Update(m_xrqContext);
+    m_panelManager.DispatchInput(m_panelInput.GetRays());
+
+    //an eye image the compositor didn't hand back in time is carried over, the projection is left out this frame
+    bool bEyesDrawn = true;
+    for (int i = 0; i < 2; i++) {
+        GLuint unSwapchainTexture = m_swapchainScheduler.WaitForImage(anEyeImages[i]);
+        if (unSwapchainTexture == 0) {
+            bEyesDrawn = false;
+            continue;
         }
-        XRQSetProjectionViewsFromCurrentFrameViews(m_xrqContext, m_vProjectionViews);
-        m_layerProjection.space = m_xrqContext.mapReferenceSpaceSpaces.at(m_xrqContext.playSpace);
 
-        std::vector<XrCompositionLayerBaseHeader *> vLayers = {
-                (XrCompositionLayerBaseHeader *) &m_layerProjection,
-                m_pUIPanel->RenderFrame(m_xrqContext)
-        };
+        GL_CHECK(glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer));
+        GL_CHECK(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, unSwapchainTexture, 0));
 
-        XrFrameEndInfo frame_end_info = {
-                .type = XR_TYPE_FRAME_END_INFO,
-                .next = nullptr,
-                .displayTime = m_xrqContext.currentFrameState.predictedDisplayTime,
-                .environmentBlendMode = XR_ENVIRONMENT_BLEND_MODE_OPAQUE,
-                .layerCount = (uint32_t) vLayers.size(),
-                .layers = vLayers.data(),
-        };
-        QUALIFY_XR_VOID(m_xrqContext.instance, xrEndFrame(m_xrqContext.session, &frame_end_info));
+        GL_CHECK(glClearColor(.5f, .5f, .5f, 1.f));
+        GL_CHECK(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
+
+        GL_CHECK(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+    }
+    XRQSetProjectionViewsFromCurrentFrameViews(m_xrqContext, m_vProjectionViews);
+    m_layerProjection.space = m_xrqContext.mapReferenceSpaceSpaces.at(m_xrqContext.playSpace);
+
+    std::vector<XrCompositionLayerBaseHeader *> vLayers;
+    if (bEyesDrawn) {
+        vLayers.push_back((XrCompositionLayerBaseHeader *) &m_layerProjection);
+    }
+    m_panelManager.RenderFrame(m_xrqContext, m_swapchainScheduler, vLayers);
+
+    //every image goes back in one pass, after all GL work that writes them has been issued
+    m_swapchainScheduler.ReleaseAll();
+
+    //the layers point at the panels' poses, so this is what gets submitted
+    m_panelManager.LateLatchPoses(m_xrqContext);
+
+    XrFrameEndInfo frame_end_info = {
+            .type = XR_TYPE_FRAME_END_INFO,
+            .next = nullptr,
+            .displayTime = m_xrqContext.currentFrameState.predictedDisplayTime,
+            .environmentBlendMode = XR_ENVIRONMENT_BLEND_MODE_OPAQUE,
+            .layerCount = (uint32_t) vLayers.size(),
+            .layers = vLayers.data(),
+    };
+    QUALIFY_XR_VOID(m_xrqContext.instance, xrEndFrame(m_xrqContext.session, &frame_end_info));
+}
+
+void Program::PollEyeTrackingPermission() {
+    if (!m_bAwaitingEyeTrackingPermission) {
+        return;
+    }
+
+    const uint64_t ulTimeNowUS = GetCurrentTimeUS();
+    if (ulTimeNowUS < m_ulNextPermissionPollTimeUS) {
+        return;
+    }
+    m_ulNextPermissionPollTimeUS = ulTimeNowUS + k_ulPermissionPollIntervalUS;
+
+    if (!BHasPermission(k_sEyeTrackingPermission)) {
+        return;
+    }
+
+    m_bAwaitingEyeTrackingPermission = false;
+    if (XRQCreateEyeTracker(m_xrqContext)) {
+        Log("[XrProgram] Eye tracking granted, gaze picks the focused panel");
+    } else {
+        Log(LogWarning, "[XrProgram] Eye tracking granted, but the eye tracker could not be created");
     }
 }
 
@@ -12,19 +12,24 @@
 #include "openxr/openxr_platform.h"
 
 #include "xrq.h"
-#include "xruipanel.h"
+#include "panelmanager.h"
 
 class Program {
 public:
     Program(android_app *pApp, app_state *pAppState);
 
-    bool BInit();
+    //the pipelined frame loop waits on frames on a pacing thread, so this thread's work for a frame overlaps the wait
+    //for the next one. The serial loop waits on each frame right before rendering it
+    bool BInit(bool bPipelinedFrameLoop);
 
     void Tick();
 
     ~Program();
 
 private:
+    //creates the eye tracker once the user grants the permission requested in BInit
+    void PollEyeTrackingPermission();
+
     android_app *m_pApp;
     app_state *m_pAppState;
 
@@ -33,7 +38,18 @@ private:
     XRQSwapchain m_projectionSwapchains[2];
     XRQSwapchain m_quadSwapchain;
 
-    std::unique_ptr<XrUIPanel> m_pUIPanel;
+    PanelManager m_panelManager;
+    PanelInput m_panelInput;
+    XRQFrameSwapchainScheduler m_swapchainScheduler;
+
+    //only used with the pipelined frame loop, after the context so it is stopped before the session goes away
+    XRQFramePacer m_framePacer;
+
+    bool m_bPipelinedFrameLoop = true;
+
+    bool m_bAwaitingEyeTrackingPermission = false;
+    uint64_t m_ulNextPermissionPollTimeUS = 0;
+
     GLuint m_framebuffer;
     std::array<XrCompositionLayerProjectionView, 2> m_vProjectionViews{};
     XrCompositionLayerProjection m_layerProjection{};
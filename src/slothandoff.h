@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+// Lock free ownership handoff of a fixed set of slots between one producing and one consuming thread, always
+// handing over the newest complete slot. The slots themselves live with the owner, this only tracks who may touch them.
+// A slot's contents are published by EndWrite and handed back by Release, so anything written before either is
+// visible to the side that picks the slot up next.
+class SlotHandoff
+{
+public:
+	enum ESlotState : uint32_t
+	{
+		SLOT_STATE_FREE,       // available to the producer
+		SLOT_STATE_WRITING,    // owned by the producer
+		SLOT_STATE_READY,      // holds the newest complete frame
+		SLOT_STATE_IN_FLIGHT,  // owned by the consumer until it releases the slot
+	};
+
+	// Slots start out owned by the consumer, which releases them once they are usable.
+	explicit SlotHandoff( uint32_t unSlotCount )
+		: m_pStates( std::make_unique<std::atomic<uint32_t>[]>( unSlotCount )), m_unSlotCount( unSlotCount )
+	{
+		for ( uint32_t i = 0; i < m_unSlotCount; i++ )
+		{
+			m_pStates[ i ].store( SLOT_STATE_IN_FLIGHT, std::memory_order_relaxed );
+		}
+	}
+
+	uint32_t GetSlotCount() const
+	{
+		return m_unSlotCount;
+	}
+
+	// Producer side. Returns -1 if every slot is owned by the consumer.
+	// If the previous frame has not been picked up yet, its slot is reclaimed and bOutReclaimed is set.
+	int BeginWrite( bool &bOutReclaimed )
+	{
+		//latest wins: take back a frame the consumer has not picked up yet before using a free slot
+		for ( uint32_t unWanted: {SLOT_STATE_READY, SLOT_STATE_FREE} )
+		{
+			for ( uint32_t i = 0; i < m_unSlotCount; i++ )
+			{
+				uint32_t unExpected = unWanted;
+				if ( m_pStates[ i ].compare_exchange_strong( unExpected, SLOT_STATE_WRITING, std::memory_order_acquire ))
+				{
+					bOutReclaimed = unWanted == SLOT_STATE_READY;
+					return (int) i;
+				}
+			}
+		}
+
+		bOutReclaimed = false;
+		return -1;
+	}
+
+	// Producer side, publishes everything written to the slot since BeginWrite.
+	void EndWrite( int nSlot )
+	{
+		m_pStates[ nSlot ].store( SLOT_STATE_READY, std::memory_order_release );
+	}
+
+	// Producer side, hands the slot back without publishing it.
+	void AbortWrite( int nSlot )
+	{
+		m_pStates[ nSlot ].store( SLOT_STATE_FREE, std::memory_order_release );
+	}
+
+	// Consumer side. Takes the newest complete frame, returns -1 if there is none.
+	// The producer only ever has one frame ready, so the first match is the newest.
+	int Acquire()
+	{
+		for ( uint32_t i = 0; i < m_unSlotCount; i++ )
+		{
+			uint32_t unExpected = SLOT_STATE_READY;
+			if ( m_pStates[ i ].compare_exchange_strong( unExpected, SLOT_STATE_IN_FLIGHT, std::memory_order_acquire ))
+			{
+				return (int) i;
+			}
+		}
+
+		return -1;
+	}
+
+	// Consumer side.
+	bool BIsInFlight( int nSlot ) const
+	{
+		return m_pStates[ nSlot ].load( std::memory_order_relaxed ) == SLOT_STATE_IN_FLIGHT;
+	}
+
+	// Consumer side, hands an acquired slot back to the producer along with everything written to it since.
+	void Release( int nSlot )
+	{
+		m_pStates[ nSlot ].store( SLOT_STATE_FREE, std::memory_order_release );
+	}
+
+private:
+	std::unique_ptr<std::atomic<uint32_t>[]> m_pStates;
+	uint32_t m_unSlotCount = 0;
+};
\ No newline at end of file
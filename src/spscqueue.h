@@ -0,0 +1,61 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Fixed capacity ring for handing values from one thread to another without locks or allocations.
+// There may only be a single pushing thread and a single popping thread at a time.
+template<typename T, uint32_t k_unCapacity>
+class SPSCQueue
+{
+	static_assert( k_unCapacity != 0 && ( k_unCapacity & ( k_unCapacity - 1 )) == 0, "capacity must be a power of two" );
+
+public:
+	// Producer side. Returns false and drops the value if the queue is full.
+	bool BPush( const T &value )
+	{
+		const uint32_t unTail = m_unTail.load( std::memory_order_relaxed );
+		if ( unTail - m_unHead.load( std::memory_order_acquire ) == k_unCapacity )
+		{
+			return false;
+		}
+
+		m_aValues[ unTail & ( k_unCapacity - 1 ) ] = value;
+		m_unTail.store( unTail + 1, std::memory_order_release );
+		return true;
+	}
+
+	// Consumer side. Returns false if there is nothing to pop.
+	bool BPop( T &outValue )
+	{
+		const uint32_t unHead = m_unHead.load( std::memory_order_relaxed );
+		if ( unHead == m_unTail.load( std::memory_order_acquire ))
+		{
+			return false;
+		}
+
+		outValue = m_aValues[ unHead & ( k_unCapacity - 1 ) ];
+		m_unHead.store( unHead + 1, std::memory_order_release );
+		return true;
+	}
+
+	// Producer side, a lower bound since the consumer may be popping concurrently.
+	uint32_t GetFreeCount() const
+	{
+		return k_unCapacity - ( m_unTail.load( std::memory_order_relaxed ) - m_unHead.load( std::memory_order_acquire ));
+	}
+
+	// Either side, only a snapshot since the other side may be pushing or popping concurrently.
+	bool BIsEmpty() const
+	{
+		return m_unHead.load( std::memory_order_acquire ) == m_unTail.load( std::memory_order_acquire );
+	}
+
+private:
+	//kept on separate cache lines so the two sides don't keep stealing each other's line
+	alignas( 64 ) std::atomic<uint32_t> m_unHead = 0;
+	alignas( 64 ) std::atomic<uint32_t> m_unTail = 0;
+
+	std::array<T, k_unCapacity> m_aValues = {};
+};
\ No newline at end of file
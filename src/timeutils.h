@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+
+// Monotonic time in microseconds, unaffected by clock adjustments. Only meaningful relative to other calls.
+inline uint64_t GetCurrentTimeUS()
+{
+	struct timespec tsp;
+	clock_gettime( CLOCK_MONOTONIC_RAW, &tsp );
+	return (uint64_t) tsp.tv_sec * 1000000LL + tsp.tv_nsec / 1000;
+}
\ No newline at end of file
@@ -3,13 +3,103 @@
 
 #include "android.h"
 #include "check.h"
+#include "timeutils.h"
 
+#include <algorithm>
+#include <cinttypes>
+#include <cmath>
 #include <utility>
 
+#include <android/bitmap.h>
+
+#include "glm/gtc/matrix_transform.hpp"
+
 extern android_app *gApp;
 
 static jobject s_contentView = nullptr;
 
+//one slot being written, one holding the newest frame, one being read by the GPU
+static const uint32_t k_unPixelBufferRingSlots = 3;
+
+static const uint32_t k_unUploadStatsLogIntervalFrames = 600;
+
+static const uint32_t k_unFrameStatsLogIntervalFrames = 600;
+
+//an idle page is still redrawn this often, as a backstop for changes that neither invalidate it nor redraw its window
+static const uint64_t k_ulIdleDrawHeartbeatUS = 500000;
+
+static const uint32_t k_unDrawStatsLogIntervalRequests = 600;
+
+//local refs a single web message needs while it's being handled
+static const jint k_nMessageLocalFrameCapacity = 16;
+
+//message channels can only be set up once the page has loaded, which is polled for with a growing delay
+static const std::chrono::milliseconds k_msMessageChannelRetryMin( 5 );
+static const std::chrono::milliseconds k_msMessageChannelRetryMax( 100 );
+
+//tags for UI thread tasks that only need to be queued once per webview
+enum EUIThreadTask
+{
+	UI_THREAD_TASK_DRAW = 1,
+	UI_THREAD_TASK_INITIALIZE_MESSAGE_CHANNELS = 2,
+	UI_THREAD_TASK_FLUSH_MESSAGES = 3,
+	UI_THREAD_TASK_DISPATCH_POINTER_EVENTS = 4,
+};
+
+//MotionEvent actions and input sources, indexed by EPointerAction
+static const std::array<jint, 7> k_anMotionEventActions = {
+		0, //ACTION_DOWN
+		2, //ACTION_MOVE
+		1, //ACTION_UP
+		3, //ACTION_CANCEL
+		9, //ACTION_HOVER_ENTER
+		7, //ACTION_HOVER_MOVE
+		10, //ACTION_HOVER_EXIT
+};
+
+static const jint k_nInputSourceTouchscreen = 0x00001002;
+static const jint k_nInputSourceMouse = 0x00002002;
+
+//same clock as SystemClock.uptimeMillis(), which MotionEvent times are in
+static uint64_t GetUptimeUS()
+{
+	struct timespec tsp;
+	clock_gettime( CLOCK_MONOTONIC, &tsp );
+	return (uint64_t) tsp.tv_sec * 1000000LL + tsp.tv_nsec / 1000;
+}
+
+//moves are predicted at most this far ahead, beyond that a turn of the hand overshoots more than the lag it hides
+static const uint64_t k_ulMaxPointerPredictionUS = 33000;
+
+//longer gaps between draw requests mean the panel went idle, not that it draws that slowly
+static const uint64_t k_ulMaxDrawRequestIntervalUS = 50000;
+
+//samples further apart than this belong to separate gestures as far as velocity goes
+static const uint64_t k_ulMaxPointerVelocityGapUS = 100000;
+
+//separates the messages batched into a single web message, the page splits on the same character
+static const char k_chMessageSeparator = '\x1e';
+
+//mailbox the page decodes binary frames from, keep in sync with webview.html
+static const std::string_view k_sBinaryMailboxName = "binary";
+
+//FNV-1a
+static uint64_t HashMailboxName( std::string_view sMailboxName )
+{
+	uint64_t ulHash = 14695981039346656037ull;
+	for ( char c: sMailboxName )
+	{
+		ulHash = ( ulHash ^ (uint8_t) c ) * 1099511628211ull;
+	}
+
+	return ulHash;
+}
+
+int32_t GetScaledExtent( int32_t nExtent, float fRenderScale )
+{
+	return std::max( 1, (int32_t) ceilf( (float) nExtent * fRenderScale ));
+}
+
 enum JColor
 {
 	JCOLOR_TRANSPARENT = 0,
@@ -24,13 +114,23 @@ void WebView::UIThread_SetupWebView()
 	m_WVTcWebView = (jclass) env->NewGlobalRef( env->FindClass( "android/webkit/WebView" ) );
 	m_WVTcCanvas = (jclass) env->NewGlobalRef(  env->FindClass( "android/graphics/Canvas" ) );
 	m_WVTcBitmap = (jclass) env->NewGlobalRef( env->FindClass( "android/graphics/Bitmap" ) );
-	m_WVTcByteBuffer = (jclass) env->NewGlobalRef( env->FindClass( "java/nio/ByteBuffer" ) );
 
 	//methods don't need ot be made global refs
 	m_WVTmWebviewDraw = env->GetMethodID( m_WVTcWebView, "draw", "(Landroid/graphics/Canvas;)V" );
 	m_WVTmCanvasDrawColor = env->GetMethodID( m_WVTcCanvas, "drawColor", "(ILandroid/graphics/PorterDuff$Mode;)V" );
-	m_WVTmBitmapCopyPixelsToBuffer = env->GetMethodID( m_WVTcBitmap, "copyPixelsToBuffer", "(Ljava/nio/Buffer;)V" );
-	m_WVTmBufferRewind = env->GetMethodID( m_WVTcByteBuffer, "rewind", "()Ljava/nio/Buffer;" );
+	m_WVTmCanvasSave = env->GetMethodID( m_WVTcCanvas, "save", "()I" );
+	m_WVTmCanvasRestore = env->GetMethodID( m_WVTcCanvas, "restore", "()V" );
+	m_WVTmCanvasScale = env->GetMethodID( m_WVTcCanvas, "scale", "(FF)V" );
+	m_WVTmViewIsDirty = env->GetMethodID( m_WVTcWebView, "isDirty", "()Z" );
+	m_WVTmViewGetDrawingTime = env->GetMethodID( m_WVTcWebView, "getDrawingTime", "()J" );
+
+	m_WVTcMotionEvent = (jclass) env->NewGlobalRef( env->FindClass( "android/view/MotionEvent" ) );
+	m_WVTmMotionEventObtain = env->GetStaticMethodID( m_WVTcMotionEvent, "obtain", "(JJIFFI)Landroid/view/MotionEvent;" );
+	m_WVTmMotionEventSetSource = env->GetMethodID( m_WVTcMotionEvent, "setSource", "(I)V" );
+	m_WVTmMotionEventRecycle = env->GetMethodID( m_WVTcMotionEvent, "recycle", "()V" );
+	m_WVTmMotionEventAddBatch = env->GetMethodID( m_WVTcMotionEvent, "addBatch", "(JFFFFI)V" );
+	m_WVTmViewDispatchTouchEvent = env->GetMethodID( m_WVTcWebView, "dispatchTouchEvent", "(Landroid/view/MotionEvent;)Z" );
+	m_WVTmViewDispatchGenericMotionEvent = env->GetMethodID( m_WVTcWebView, "dispatchGenericMotionEvent", "(Landroid/view/MotionEvent;)Z" );
 
 	//create webview
 	jclass cActivity = env->FindClass( "android/app/Activity" );
@@ -112,7 +212,8 @@ void WebView::UIThread_SetupWebView()
 		env->CallVoidMethod( mc0, mSetWebMessageCallback, (jobject) 0, handler );
 	}
 
-	//Setup bitmap and canvas
+	//Setup bitmap and canvas, the surface texture path locks a canvas from its surface for every draw instead
+	if ( m_eCaptureMode == WEBVIEW_CAPTURE_MODE_SOFTWARE )
 	{
 		jclass cBitmapConfig = env->FindClass( "android/graphics/Bitmap$Config" );
 
@@ -168,10 +269,11 @@ void WebView::UIThread_SetupWebView()
 	}
 
 	m_bIsWebViewSetup = true;
+	NotifyStateChanged();
 	Log( "[WebView] WebView completed setup!" );
 }
 
-WebView::WebView( int32_t nWidth, int32_t nHeight, std::string sBaseUrl )
+WebView::WebView( int32_t nWidth, int32_t nHeight, std::string sBaseUrl, EWebViewCaptureMode eCaptureMode )
 {
 	m_webViewInfo = {
 			.nWidth = nWidth,
@@ -179,19 +281,93 @@ WebView::WebView( int32_t nWidth, int32_t nHeight, std::string sBaseUrl )
 			.sBaseUrl = std::move( sBaseUrl ),
 	};
 
-	SETUP_FOR_JAVA_CALL
+	m_eCaptureMode = eCaptureMode;
 
 	m_bufferbytes = (uint8_t *) malloc( m_webViewInfo.nWidth * m_webViewInfo.nHeight * 4 );
-	m_buffer = env->NewDirectByteBuffer( m_bufferbytes, m_webViewInfo.nWidth * m_webViewInfo.nHeight * 4 );
-	m_buffer = env->NewGlobalRef( m_buffer );
+
+	//created here as WebViews are constructed on the render thread, which owns the GL context
+	if ( m_eCaptureMode == WEBVIEW_CAPTURE_MODE_SURFACE_TEXTURE && !CreateSurfaceTexture())
+	{
+		Log( LogError, "[WebView] Failed to create surface texture, falling back to software capture" );
+		m_eCaptureMode = WEBVIEW_CAPTURE_MODE_SOFTWARE;
+	}
+
+	if ( m_eCaptureMode == WEBVIEW_CAPTURE_MODE_SOFTWARE )
+	{
+		m_pDamageTracker = std::make_unique<DamageTracker>( m_webViewInfo.nWidth, m_webViewInfo.nHeight );
+		m_pPixelBufferRing = std::make_unique<PixelBufferRing>( k_unPixelBufferRingSlots, m_webViewInfo.nWidth, m_webViewInfo.nHeight );
+		m_pContentTexture = std::make_unique<Texture>( false, 0, false, m_webViewInfo.nWidth, m_webViewInfo.nHeight );
+	}
 
 	m_bIsRunning = true;
 	m_webViewThread = std::thread( &WebView::WebViewThread, this );
 }
 
-std::shared_ptr<WebView> WebView::Create( int32_t nWidth, int32_t nHeight, std::string sBaseUrl )
+void WebView::NotifyStateChanged()
 {
-	return std::shared_ptr<WebView>(new WebView( nWidth, nHeight, sBaseUrl ) );
+	//taking the lock means a waiter is either about to check the new state or already asleep
+	{
+		std::scoped_lock<std::mutex> lock( m_mutState );
+	}
+	m_cvState.notify_all();
+}
+
+std::shared_ptr<WebView> WebView::Create( int32_t nWidth, int32_t nHeight, std::string sBaseUrl, EWebViewCaptureMode eCaptureMode )
+{
+	return std::shared_ptr<WebView>(new WebView( nWidth, nHeight, sBaseUrl, eCaptureMode ) );
+}
+
+bool WebView::CreateSurfaceTexture()
+{
+	SETUP_FOR_JAVA_CALL
+
+	m_pSurfaceTexture = std::make_unique<Texture>( false, 0, true, m_webViewInfo.nWidth, m_webViewInfo.nHeight );
+
+	jclass cSurfaceTexture = env->FindClass( "android/graphics/SurfaceTexture" );
+	jmethodID mSurfaceTexture = env->GetMethodID( cSurfaceTexture, "<init>", "(I)V" );
+	jobject surfaceTexture = env->NewObject( cSurfaceTexture, mSurfaceTexture, (jint) m_pSurfaceTexture->GetGLTexture());
+	if ( env->ExceptionCheck() || !surfaceTexture )
+	{
+		env->ExceptionClear();
+		m_pSurfaceTexture = nullptr;
+		return false;
+	}
+
+	jmethodID mSetDefaultBufferSize = env->GetMethodID( cSurfaceTexture, "setDefaultBufferSize", "(II)V" );
+	env->CallVoidMethod( surfaceTexture, mSetDefaultBufferSize, m_webViewInfo.nWidth, m_webViewInfo.nHeight );
+
+	jclass cSurface = env->FindClass( "android/view/Surface" );
+	jmethodID mSurface = env->GetMethodID( cSurface, "<init>", "(Landroid/graphics/SurfaceTexture;)V" );
+	jobject surface = env->NewObject( cSurface, mSurface, surfaceTexture );
+	if ( env->ExceptionCheck() || !surface )
+	{
+		env->ExceptionClear();
+		jmethodID mRelease = env->GetMethodID( cSurfaceTexture, "release", "()V" );
+		env->CallVoidMethod( surfaceTexture, mRelease );
+		m_pSurfaceTexture = nullptr;
+		return false;
+	}
+
+	m_webViewInfo.surfaceTexture = env->NewGlobalRef( surfaceTexture );
+	m_webViewInfo.surface = env->NewGlobalRef( surface );
+
+	//methods don't need to be made global refs
+	m_WVTmSurfaceLockHardwareCanvas = env->GetMethodID( cSurface, "lockHardwareCanvas", "()Landroid/graphics/Canvas;" );
+	m_WVTmSurfaceUnlockCanvasAndPost = env->GetMethodID( cSurface, "unlockCanvasAndPost", "(Landroid/graphics/Canvas;)V" );
+	m_WVTmSurfaceTextureUpdateTexImage = env->GetMethodID( cSurfaceTexture, "updateTexImage", "()V" );
+	m_WVTmSurfaceTextureGetTransformMatrix = env->GetMethodID( cSurfaceTexture, "getTransformMatrix", "([F)V" );
+	m_WVTmSurfaceTextureGetTimestamp = env->GetMethodID( cSurfaceTexture, "getTimestamp", "()J" );
+
+	m_WVTjvSurfaceTextureTransform = (jfloatArray) env->NewGlobalRef( env->NewFloatArray( 16 ));
+
+	m_pSurfaceRenderer = std::make_unique<PanelRenderer>( PanelConfig{
+			.unTextureWidth = (uint32_t) m_webViewInfo.nWidth,
+			.unTextureHeight = (uint32_t) m_webViewInfo.nHeight,
+			.eCaptureMode = WEBVIEW_CAPTURE_MODE_SURFACE_TEXTURE,
+	} );
+
+	Log( "[WebView] Capturing webview through a surface texture" );
+	return true;
 }
 
 void WebView::UIThread_InitializeMessageChannels()
@@ -229,8 +405,15 @@ void WebView::UIThread_InitializeMessageChannels()
 	jmethodID mPostWebMessage = env->GetMethodID( m_WVTcWebView, "postWebMessage", "(Landroid/webkit/WebMessage;Landroid/net/Uri;)V" );
 	env->CallVoidMethod( m_webViewInfo.webView, mPostWebMessage, webMessage, emptyUri );
 
+	//outgoing messages are posted on the port we kept, mc0
+	m_webViewInfo.messagePort = env->NewGlobalRef( env->GetObjectArrayElement( m_webViewInfo.messageChannels, 0 ));
+	m_WVTcWebMessage = (jclass) env->NewGlobalRef( cWebMessage );
+	m_WVTmWebMessageInit = env->GetMethodID( cWebMessage, "<init>", "(Ljava/lang/String;)V" );
+	m_WVTmWebMessagePortPostMessage = env->GetMethodID( cWebMessagePort, "postMessage", "(Landroid/webkit/WebMessage;)V" );
+
 	Log( "[WebView] WebView initialized message channels!" );
 	m_bIsWebviewMessagesChannelsInitialized = true;
+	NotifyStateChanged();
 }
 
 void WebView::WebViewThread()
@@ -267,6 +450,8 @@ void WebView::WebViewThread()
 	jfieldID fObj = env->GetFieldID( cMessage, "obj", "Ljava/lang/Object;" );
 	jclass PairClass = env->FindClass( "android/util/Pair" );
 	jfieldID fFirst = env->GetFieldID( PairClass, "first", "Ljava/lang/Object;" );
+	jclass cClass = env->FindClass( "java/lang/Class" );
+	m_WVTmClassGetName = env->GetMethodID( cClass, "getName", "()Ljava/lang/String;" );
 
 	Log("[WebView] Attempting to setup webview...");
 	gApp->uiThreadCallbackHandler->post([pWeak = GetWeakPtr()]()
@@ -278,149 +463,780 @@ void WebView::WebViewThread()
 										 } );
 
 	Log("[WebView] Waiting for webview to setup...");
-	while ( m_bIsRunning && !m_bIsWebViewSetup )
 	{
-		std::this_thread::sleep_for( std::chrono::milliseconds( 1 ));
+		std::unique_lock<std::mutex> lock( m_mutState );
+		m_cvState.wait( lock, [ this ] { return !m_bIsRunning || m_bIsWebViewSetup; } );
 	}
 
 	Log( "[WebView] WebView finished setup. Waiting for message channels to initialize..." );
 
+	std::chrono::milliseconds msRetryDelay = k_msMessageChannelRetryMin;
 	while ( m_bIsRunning && !m_bIsWebviewMessagesChannelsInitialized )
 	{
 
-		gApp->uiThreadCallbackHandler->post([pWeak = GetWeakPtr()]()
-											 {
-												 if ( auto pWebView = pWeak.lock() )
-												 {
-													 pWebView->UIThread_InitializeMessageChannels();
-												 }
-											 } );
-
-		std::this_thread::sleep_for( std::chrono::milliseconds( 5 ));
+		gApp->uiThreadCallbackHandler->postCoalesced( UIThreadCallbackHandler::MakeTaskKey( this, UI_THREAD_TASK_INITIALIZE_MESSAGE_CHANNELS ),
+													  [pWeak = GetWeakPtr()]()
+													  {
+														  if ( auto pWebView = pWeak.lock() )
+														  {
+															  pWebView->UIThread_InitializeMessageChannels();
+														  }
+													  } );
+
+		std::unique_lock<std::mutex> lock( m_mutState );
+		m_cvState.wait_for( lock, msRetryDelay, [ this ] { return !m_bIsRunning || m_bIsWebviewMessagesChannelsInitialized; } );
+		msRetryDelay = std::min( msRetryDelay * 2, k_msMessageChannelRetryMax );
 	}
 	Log( "[WebView] WebView Message channels initialized! Sending any queued messages..." );
 
 	Log( "[WebView] WebView finished setup and is running" );
 
-	char sFromJSBuffer[128];
 	while ( m_bIsRunning )
 	{
+		//every local ref made while handling a message goes away with its frame
+		if ( env->PushLocalFrame( k_nMessageLocalFrameCapacity ) != 0 )
+		{
+			Log( LogError, "[WebView] Failed to push local frame for web message" );
+			env->ExceptionClear();
+			break;
+		}
+
+		//blocks until a message arrives, only returns null once the looper has been quit
 		jobject message = env->CallObjectMethod( messageQueue, nextMethod );
 		if ( !message )
 		{
-			std::this_thread::yield();
-			continue;
+			env->PopLocalFrame( nullptr );
+			break;
 		}
 
 		jobject messageObject = env->GetObjectField( message, fObj );
-		const char *name;
-		jstring strObj;
-		jclass innerClass;
+		WebMessageClassInfo &classInfo = WVT_GetWebMessageClassInfo( env, messageObject, PairClass );
+
+		if ( classInfo.fMessageBytes )
+		{
+			jbyteArray jvMessageBytes = (jbyteArray) env->GetObjectField( messageObject, classInfo.fMessageBytes );
+			int nMessageLength = env->GetArrayLength( jvMessageBytes );
+
+			if ( nMessageLength >= 6 )
+			{
+				//the message text starts after a 6 byte header, the buffer keeps its capacity between messages
+				m_vWVTMessageBytes.resize( nMessageLength - 6 );
+				env->GetByteArrayRegion( jvMessageBytes, 6, nMessageLength - 6, (jbyte *) m_vWVTMessageBytes.data());
+
+				WVT_DispatchMessages( std::string_view( m_vWVTMessageBytes.data(), m_vWVTMessageBytes.size()));
+			}
+		}
+		else if ( classInfo.bIsPair )
+		{
+			// MessagePayload is a org.chromium.content_public.browser.MessagePayload
+			jobject messagePayload = env->GetObjectField( messageObject, fFirst );
+
+			// Field "b" holds the payload of string messages, "c" the bytes of an ArrayBuffer.
+			if ( messagePayload )
+			{
+				WVT_ResolveWebMessagePayloadFields( env, classInfo, messagePayload );
+			}
 
-		// Check Object Type
+			jstring strObjDescr = messagePayload && classInfo.fPayloadString ? (jstring) env->GetObjectField( messagePayload, classInfo.fPayloadString ) : nullptr;
+			jbyteArray jvPayloadBytes = messagePayload && classInfo.fPayloadBytes && !strObjDescr ? (jbyteArray) env->GetObjectField( messagePayload, classInfo.fPayloadBytes ) : nullptr;
+
+			if ( strObjDescr )
+			{
+				const char *csMessage = env->GetStringUTFChars( strObjDescr, 0 );
+				WVT_DispatchMessages( csMessage );
+				env->ReleaseStringUTFChars( strObjDescr, csMessage );
+			}
+			else if ( jvPayloadBytes )
+			{
+				WVT_DispatchBinaryMessage( env, jvPayloadBytes );
+			}
+		}
+
+		env->PopLocalFrame( nullptr );
+	}
+
+	for ( WebMessageClassInfo &classInfo: m_vWVTWebMessageClasses )
+	{
+		env->DeleteGlobalRef( classInfo.cClass );
+		env->DeleteGlobalRef( classInfo.cPayloadClass );
+	}
+	m_vWVTWebMessageClasses.clear();
+}
+
+void WebView::WVT_DispatchMessages( std::string_view sMessages )
+{
+	while ( !sMessages.empty())
+	{
+		const size_t unMessageEnd = sMessages.find( k_chMessageSeparator );
+		const std::string_view sMessage = sMessages.substr( 0, unMessageEnd );
+		sMessages.remove_prefix( unMessageEnd == std::string_view::npos ? sMessages.size() : unMessageEnd + 1 );
+
+		//"<mailbox> <data>"
+		const size_t unNameEnd = sMessage.find( ' ' );
+		const std::string_view sMailboxName = sMessage.substr( 0, unNameEnd );
+		const std::string_view sMessageData = unNameEnd == std::string_view::npos ? std::string_view() : sMessage.substr( unNameEnd + 1 );
+
+		std::shared_ptr<const MailboxHandler> pHandler;
 		{
-			innerClass = env->GetObjectClass( messageObject );
-			jmethodID mid = env->GetMethodID( innerClass, "getClass", "()Ljava/lang/Class;" );
-			jobject clsObj = env->CallObjectMethod( messageObject, mid );
-			jclass clazzz = env->GetObjectClass( clsObj );
-			mid = env->GetMethodID( clazzz, "getName", "()Ljava/lang/String;" );
-			strObj = (jstring) env->CallObjectMethod( clsObj, mid );
-			name = env->GetStringUTFChars( strObj, 0 );
+			std::scoped_lock<std::mutex> lock( m_mutMailboxHandlers );
+			auto it = m_mapMailboxHandlers.find( HashMailboxName( sMailboxName ));
+			if ( it != m_mapMailboxHandlers.end() && it->second.sName == sMailboxName )
+			{
+				pHandler = it->second.pHandler;
+			}
 		}
 
-		//z5 - quest, U4 - pico
-		if ( strcmp( name, "z5" ) == 0 || strcmp( name, "U4" ) == 0 )
+		if ( !pHandler )
 		{
-			jfieldID fString = env->GetFieldID( innerClass, "a", "[B" );
-			jbyteArray jvMessageBytes = (jbyteArray) env->GetObjectField( messageObject, fString );
-			int nMessageLength = env->GetArrayLength( jvMessageBytes );
+			Log( LogWarning, "[WebView] No handler for mailbox %.*s", (int) sMailboxName.size(), sMailboxName.data());
+			continue;
+		}
+
+		( *pHandler )( sMessageData );
+	}
+}
 
-			jboolean jbIsCopy = 0;
-			jbyte *jpBuffer = env->GetByteArrayElements( jvMessageBytes, &jbIsCopy );
+void WebView::WVT_DispatchBinaryMessage( JNIEnv *env, jbyteArray jvMessage )
+{
+	const jsize nMessageLength = env->GetArrayLength( jvMessage );
 
-			if ( nMessageLength >= 6 )
+	//copied out rather than pinned, so handlers run without holding up the GC and may call into java.
+	//the buffer keeps its capacity between messages
+	m_vWVTBinaryMessageBytes.resize( nMessageLength );
+	env->GetByteArrayRegion( jvMessage, 0, nMessageLength, (jbyte *) m_vWVTBinaryMessageBytes.data());
+
+	BinaryFrameReader reader( m_vWVTBinaryMessageBytes.data(), m_vWVTBinaryMessageBytes.size());
+	BinaryFrame frame;
+	while ( reader.Next( frame ))
+	{
+		uint32_t &unExpectedSequence = m_mapWVTBinarySequences[ frame.usType ];
+		if ( frame.unSequence != unExpectedSequence )
+		{
+			Log( LogWarning, "[WebView] Binary frame type %u sequence %u, expected %u", frame.usType, frame.unSequence, unExpectedSequence );
+		}
+		unExpectedSequence = frame.unSequence + 1;
+
+		std::shared_ptr<const BinaryHandler> pHandler;
+		{
+			std::scoped_lock<std::mutex> lock( m_mutMailboxHandlers );
+			auto it = m_mapBinaryHandlers.find( frame.usType );
+			if ( it != m_mapBinaryHandlers.end())
 			{
-				const char *sDescription = (const char *) jpBuffer + 6;
-				char csMessage[ nMessageLength - 5];
-				memcpy( csMessage, sDescription, nMessageLength - 6 );
-				csMessage[ nMessageLength - 6 ] = 0;
-				snprintf( sFromJSBuffer, sizeof(sFromJSBuffer) - 1, "WebMessage: %s\n", csMessage );
-
-				std::string sMessage( csMessage );
-				std::string sMailboxName = sMessage.substr( 0, sMessage.find( ' ' ));
-				std::string sMessageData = sMessage.substr( sMessage.find( ' ' ) + 1 );
+				pHandler = it->second;
 			}
 		}
-		else
+
+		if ( !pHandler )
 		{
-			// MessagePayload is a org.chromium.content_public.browser.MessagePayload
-			jobject messagePayload = env->GetObjectField((jobject) messageObject, fFirst );
+			Log( LogWarning, "[WebView] No handler for binary frame type %u", frame.usType );
+			continue;
+		}
 
-			jclass cMessagePayload = env->GetObjectClass( messagePayload );
+		( *pHandler )( frame );
+	}
 
-			// Get field "b" which is the web message payload.
-			// If you are using binary sockets, it will be in `c` and be a byte array.
-			jfieldID fMessagePayload = env->GetFieldID( cMessagePayload, "b", "Ljava/lang/String;" );
-			jstring strObjDescr = (jstring) env->GetObjectField( messagePayload, fMessagePayload );
+	if ( reader.BIsTruncated())
+	{
+		Log( LogError, "[WebView] Binary web message of %d bytes ends in a truncated frame", nMessageLength );
+	}
+}
 
-			const char *csMessage = env->GetStringUTFChars( strObjDescr, 0 );
-			snprintf( sFromJSBuffer, sizeof( sFromJSBuffer ) - 1, "WebMessage: %s\n", csMessage );
+WebView::WebMessageClassInfo &WebView::WVT_GetWebMessageClassInfo( JNIEnv *env, jobject messageObject, jclass cPair )
+{
+	jclass cMessageObject = env->GetObjectClass( messageObject );
+	for ( WebMessageClassInfo &classInfo: m_vWVTWebMessageClasses )
+	{
+		if ( env->IsSameObject( cMessageObject, classInfo.cClass ))
+		{
+			return classInfo;
+		}
+	}
 
-			std::string sMessage( csMessage );
-			std::string sMailboxName = sMessage.substr( 0, sMessage.find( ' ' ));
-			std::string sMessageData = sMessage.substr( sMessage.find( ' ' ) + 1 );
+	WebMessageClassInfo classInfo;
+	classInfo.cClass = (jclass) env->NewGlobalRef( cMessageObject );
+	classInfo.bIsPair = env->IsInstanceOf( messageObject, cPair );
 
+	jstring strName = (jstring) env->CallObjectMethod( cMessageObject, m_WVTmClassGetName );
+	const char *name = env->GetStringUTFChars( strName, 0 );
 
-			env->ReleaseStringUTFChars( strObjDescr, csMessage );
+	//z5 - quest, U4 - pico
+	if ( strcmp( name, "z5" ) == 0 || strcmp( name, "U4" ) == 0 )
+	{
+		classInfo.fMessageBytes = env->GetFieldID( cMessageObject, "a", "[B" );
+		if ( env->ExceptionCheck())
+		{
+			env->ExceptionClear();
+			classInfo.fMessageBytes = nullptr;
 		}
+	}
+
+	Log( "[WebView] Resolved web message class %s", name );
+	env->ReleaseStringUTFChars( strName, name );
+
+	m_vWVTWebMessageClasses.push_back( classInfo );
+	return m_vWVTWebMessageClasses.back();
+}
+
+void WebView::WVT_ResolveWebMessagePayloadFields( JNIEnv *env, WebMessageClassInfo &classInfo, jobject messagePayload )
+{
+	jclass cMessagePayload = env->GetObjectClass( messagePayload );
+	if ( classInfo.cPayloadClass && env->IsSameObject( cMessagePayload, classInfo.cPayloadClass ))
+	{
+		return;
+	}
+
+	env->DeleteGlobalRef( classInfo.cPayloadClass );
+	classInfo.cPayloadClass = (jclass) env->NewGlobalRef( cMessagePayload );
+
+	classInfo.fPayloadString = env->GetFieldID( cMessagePayload, "b", "Ljava/lang/String;" );
+	if ( env->ExceptionCheck())
+	{
+		env->ExceptionClear();
+		classInfo.fPayloadString = nullptr;
+	}
 
-		std::this_thread::yield();
+	classInfo.fPayloadBytes = env->GetFieldID( cMessagePayload, "c", "[B" );
+	if ( env->ExceptionCheck())
+	{
+		env->ExceptionClear();
+		classInfo.fPayloadBytes = nullptr;
 	}
 }
 
 void WebView::UIThread_Draw()
 {
+	const uint64_t ulTimeNowUS = GetCurrentTimeUS();
+
+	//draw requests arrive at the panel's cadence, which tells pointer prediction when the next draw will be
+	if ( m_ulLastDrawRequestHandledTimeUS != 0 )
+	{
+		const uint64_t ulIntervalUS = std::min( ulTimeNowUS - m_ulLastDrawRequestHandledTimeUS, k_ulMaxDrawRequestIntervalUS );
+		m_ulDrawRequestIntervalEstimateUS = m_ulDrawRequestIntervalEstimateUS - m_ulDrawRequestIntervalEstimateUS / 8 + ulIntervalUS / 8;
+	}
+	m_ulLastDrawRequestHandledTimeUS = ulTimeNowUS;
+
+	//zero if a request raced the previous draw taking its timestamp
+	uint64_t ulDrawRequestTimeUS = m_ulDrawRequestTimeUS.exchange( 0 );
+	if ( ulDrawRequestTimeUS == 0 )
+	{
+		ulDrawRequestTimeUS = ulTimeNowUS;
+	}
+
 	if ( !m_bIsWebviewMessagesChannelsInitialized || !m_bIsRunning )
 	{
 		return;
 	}
 
-	m_bIsDrawing = true;
-
 	SETUP_FOR_JAVA_CALL
 
+	//the webview invalidates itself whenever its content changes or an animation ticks, but the window it is attached
+	//to draws it on its own and clears the dirty flag when it does. the window's drawing time only moves on when it
+	//drew, so a change since our last draw means an invalidation we may have missed (or one of a sibling panel's)
+	const int64_t lWindowDrawingTimeMS = env->CallLongMethod( m_webViewInfo.webView, m_WVTmViewGetDrawingTime );
+	const bool bIsInvalidated = env->CallBooleanMethod( m_webViewInfo.webView, m_WVTmViewIsDirty ) ||
+								lWindowDrawingTimeMS != m_lDrawnWindowDrawingTimeMS;
+	//a frame the render thread lost took damage with it the tracker considers published, so everything is resent
+	const bool bIsFrameLost = m_pPixelBufferRing && m_pPixelBufferRing->BTakeLostFrame();
+	if ( bIsFrameLost )
+	{
+		m_pDamageTracker->MarkAllDirty();
+	}
+
+	const float fRenderScale = m_fRequestedRenderScale.load( std::memory_order_relaxed );
+	const bool bShouldDraw = bIsInvalidated || bIsFrameLost || fRenderScale != m_fDrawnRenderScale ||
+							 ulTimeNowUS - m_ulLastDrawTimeUS >= k_ulIdleDrawHeartbeatUS;
+
+	m_unDrawStatsDraws += bShouldDraw ? 1 : 0;
+	if ( ++m_unDrawStatsRequests == k_unDrawStatsLogIntervalRequests )
+	{
+		Log( "[WebView] Drew %u of the last %u requested frames", m_unDrawStatsDraws, m_unDrawStatsRequests );
+		m_unDrawStatsRequests = 0;
+		m_unDrawStatsDraws = 0;
+	}
+
+	if ( !bShouldDraw )
+	{
+		return;
+	}
+
+	m_ulLastDrawTimeUS = ulTimeNowUS;
+	m_fDrawnRenderScale = fRenderScale;
+	m_lDrawnWindowDrawingTimeMS = lWindowDrawingTimeMS;
+
+	m_frameStats.Record( PANEL_FRAME_STAGE_DRAW_QUEUED, ulTimeNowUS - ulDrawRequestTimeUS );
+
 	{
 		std::scoped_lock<std::mutex> lock( m_mutWebView );
 
-		env->CallVoidMethod( m_webViewInfo.canvas, m_WVTmCanvasDrawColor, (jint) JCOLOR_TRANSPARENT, m_WVToPorterDuffClear );
+		if ( m_eCaptureMode == WEBVIEW_CAPTURE_MODE_SURFACE_TEXTURE )
+		{
+			UIThread_DrawToSurface( env, ulDrawRequestTimeUS, fRenderScale );
+		}
+		else
+		{
+			UIThread_DrawToBitmap( env, ulDrawRequestTimeUS, fRenderScale );
+		}
+	}
+
+	//exponential moving average over roughly the last 8 draws, read by whoever budgets UI thread time
+	const uint64_t ulDrawCostUS = GetCurrentTimeUS() - ulTimeNowUS;
+	const uint64_t ulPreviousEstimateUS = m_ulDrawCostEstimateUS.load( std::memory_order_relaxed );
+	m_ulDrawCostEstimateUS.store( ulPreviousEstimateUS - ulPreviousEstimateUS / 8 + ulDrawCostUS / 8, std::memory_order_relaxed );
+}
+
+void WebView::UIThread_DrawWebView( JNIEnv *env, jobject canvas, float fRenderScale )
+{
+	//clears the whole canvas, so nothing from a larger scale is left around the scaled down page
+	env->CallVoidMethod( canvas, m_WVTmCanvasDrawColor, (jint) JCOLOR_TRANSPARENT, m_WVToPorterDuffClear );
+
+	if ( fRenderScale == 1.f )
+	{
+		env->CallVoidMethod( m_webViewInfo.webView, m_WVTmWebviewDraw, canvas );
+		return;
+	}
+
+	env->CallIntMethod( canvas, m_WVTmCanvasSave );
+	env->CallVoidMethod( canvas, m_WVTmCanvasScale, fRenderScale, fRenderScale );
+	env->CallVoidMethod( m_webViewInfo.webView, m_WVTmWebviewDraw, canvas );
+	env->CallVoidMethod( canvas, m_WVTmCanvasRestore );
+}
+
+uint64_t WebView::UIThread_PublishContentGeneration( float fRenderScale )
+{
+	const uint64_t ulGeneration = m_ulContentGeneration.load( std::memory_order_relaxed ) + 1;
+	m_afContentRenderScales[ ulGeneration % k_unContentRenderScaleHistory ].store( fRenderScale, std::memory_order_relaxed );
+	m_ulContentGeneration.store( ulGeneration, std::memory_order_release );
+
+	return ulGeneration;
+}
+
+void WebView::UIThread_DrawToBitmap( JNIEnv *env, uint64_t ulDrawRequestTimeUS, float fRenderScale )
+{
+	const uint64_t ulStartTimeUS = GetCurrentTimeUS();
+
+	UIThread_DrawWebView( env, m_webViewInfo.canvas, fRenderScale );
+
+	const uint64_t ulDrawnTimeUS = GetCurrentTimeUS();
+	m_frameStats.Record( PANEL_FRAME_STAGE_DRAW, ulDrawnTimeUS - ulStartTimeUS );
 
-		env->CallVoidMethod( m_webViewInfo.webView, m_WVTmWebviewDraw, m_webViewInfo.canvas );
+	AndroidBitmapInfo bitmapInfo;
+	void *pBitmapPixels = nullptr;
+	if ( AndroidBitmap_getInfo( env, m_webViewInfo.bitmap, &bitmapInfo ) != ANDROID_BITMAP_RESULT_SUCCESS ||
+		 AndroidBitmap_lockPixels( env, m_webViewInfo.bitmap, &pBitmapPixels ) != ANDROID_BITMAP_RESULT_SUCCESS )
+	{
+		Log( LogError, "[WebView] Failed to lock bitmap pixels" );
+		return;
+	}
+
+	bool bHasDamage = m_pDamageTracker->Update((const uint8_t *) pBitmapPixels, bitmapInfo.stride );
+
+	AndroidBitmap_unlockPixels( env, m_webViewInfo.bitmap );
+
+	if ( bHasDamage )
+	{
+		UIThread_PublishDamage( ulDrawRequestTimeUS, fRenderScale );
+	}
+
+	m_frameStats.Record( PANEL_FRAME_STAGE_CAPTURE, GetCurrentTimeUS() - ulDrawnTimeUS );
+}
+
+void WebView::UIThread_DrawToSurface( JNIEnv *env, uint64_t ulDrawRequestTimeUS, float fRenderScale )
+{
+	const uint64_t ulStartTimeUS = GetCurrentTimeUS();
+
+	//the canvas draws into the next buffer of the surface's queue, which the render thread latches into the external texture
+	jobject canvas = env->CallObjectMethod( m_webViewInfo.surface, m_WVTmSurfaceLockHardwareCanvas );
+	if ( env->ExceptionCheck() || !canvas )
+	{
+		env->ExceptionClear();
+		Log( LogError, "[WebView] Failed to lock hardware canvas" );
+		return;
+	}
+
+	UIThread_DrawWebView( env, canvas, fRenderScale );
+
+	const uint64_t ulDrawnTimeUS = GetCurrentTimeUS();
+	m_frameStats.Record( PANEL_FRAME_STAGE_DRAW, ulDrawnTimeUS - ulStartTimeUS );
+
+	env->CallVoidMethod( m_webViewInfo.surface, m_WVTmSurfaceUnlockCanvasAndPost, canvas );
+	env->DeleteLocalRef( canvas );
+
+	const uint64_t ulPostedTimeUS = GetCurrentTimeUS();
+	m_frameStats.Record( PANEL_FRAME_STAGE_CAPTURE, ulPostedTimeUS - ulDrawnTimeUS );
+
+	m_ulSurfacePublishTimeUS = ulPostedTimeUS;
+	m_ulSurfaceDrawRequestTimeUS = ulDrawRequestTimeUS;
+	UIThread_PublishContentGeneration( fRenderScale );
+}
+
+void WebView::UIThread_PublishDamage( uint64_t ulDrawRequestTimeUS, float fRenderScale )
+{
+	int nSlot;
+	bool bReclaimed;
+	uint8_t *pSlotPixels = m_pPixelBufferRing->BeginWrite( nSlot, bReclaimed );
+	if ( !pSlotPixels )
+	{
+		//render thread still holds every slot, the damage stays pending until the next draw
+		return;
+	}
 
+	std::vector<PixelRect> &vDirtyRects = m_pPixelBufferRing->GetDirtyRects( nSlot );
+	m_pDamageTracker->TakePendingRects( bReclaimed, vDirtyRects );
+
+	const uint8_t *pShadowFrame = m_pDamageTracker->GetShadowFrame();
+	const uint32_t unStride = m_pPixelBufferRing->GetStrideBytes();
+	for ( const PixelRect &rect: vDirtyRects )
+	{
+		for ( int32_t nRow = rect.nY; nRow < rect.nY + rect.nHeight; nRow++ )
+		{
+			const uint32_t unOffset = nRow * unStride + rect.nX * 4;
+			memcpy( pSlotPixels + unOffset, pShadowFrame + unOffset, rect.nWidth * 4 );
+		}
+	}
+
+	//the slot is tagged with the generation before it is published, so the render thread can look up its scale
+	const uint64_t ulGeneration = m_ulContentGeneration.load( std::memory_order_relaxed ) + 1;
+	m_pPixelBufferRing->EndWrite( nSlot, ulDrawRequestTimeUS, ulGeneration );
+
+	UIThread_PublishContentGeneration( fRenderScale );
+}
+
+bool WebView::RegisterMailboxHandler( std::string sMailboxName, MailboxHandler handler )
+{
+	std::scoped_lock<std::mutex> lock( m_mutMailboxHandlers );
+
+	const uint64_t ulHash = HashMailboxName( sMailboxName );
+	auto it = m_mapMailboxHandlers.find( ulHash );
+	if ( it != m_mapMailboxHandlers.end() && it->second.sName != sMailboxName )
+	{
+		Log( LogError, "[WebView] Mailbox %s collides with %s", sMailboxName.c_str(), it->second.sName.c_str());
+		return false;
+	}
+
+	m_mapMailboxHandlers[ ulHash ] = MailboxRegistration{
+			.sName = std::move( sMailboxName ),
+			.pHandler = std::make_shared<const MailboxHandler>( std::move( handler )),
+	};
+
+	return true;
+}
+
+void WebView::SendMessage( std::string_view sMailboxName, std::string_view sData )
+{
+	//the page splits batches on the separator and the name on the first space, and the batch goes to java as a
+	//C string, so any of these would cut it short or arrive as bogus messages
+	static const char k_achReservedDataChars[] = {k_chMessageSeparator, '\0'};
+	static const char k_achReservedNameChars[] = {k_chMessageSeparator, '\0', ' '};
+	if ( sMailboxName.find_first_of( std::string_view( k_achReservedNameChars, sizeof( k_achReservedNameChars ))) != std::string_view::npos ||
+		 sData.find_first_of( std::string_view( k_achReservedDataChars, sizeof( k_achReservedDataChars ))) != std::string_view::npos )
+	{
+		Log( LogError, "[WebView] Dropping message to mailbox %.*s, it contains the message separator, a null or a "
+					   "space in the mailbox name", (int) sMailboxName.size(), sMailboxName.data());
+		return;
+	}
+
+	std::scoped_lock<std::mutex> lock( m_mutMessageQueueMutex );
+
+	if ( !m_sQueuedMessages.empty())
+	{
+		m_sQueuedMessages += k_chMessageSeparator;
+	}
+	m_sQueuedMessages.append( sMailboxName );
+	m_sQueuedMessages += ' ';
+	m_sQueuedMessages.append( sData );
+}
+
+void WebView::RegisterBinaryHandler( uint16_t usType, BinaryHandler handler )
+{
+	std::scoped_lock<std::mutex> lock( m_mutMailboxHandlers );
+
+	m_mapBinaryHandlers[ usType ] = std::make_shared<const BinaryHandler>( std::move( handler ));
+}
+
+void WebView::SendBinary( uint16_t usType, const void *pData, uint32_t unLength )
+{
+	std::scoped_lock<std::mutex> lock( m_mutMessageQueueMutex );
+
+	//the framework WebMessage only carries strings, so frames to the page ride the string bus as base64
+	m_vQueuedBinaryFrame.clear();
+	AppendBinaryFrame( m_vQueuedBinaryFrame, usType, m_mapBinarySequences[ usType ]++, pData, unLength );
+
+	if ( !m_sQueuedMessages.empty())
+	{
+		m_sQueuedMessages += k_chMessageSeparator;
+	}
+	m_sQueuedMessages.append( k_sBinaryMailboxName );
+	m_sQueuedMessages += ' ';
+	AppendBase64( m_sQueuedMessages, m_vQueuedBinaryFrame.data(), m_vQueuedBinaryFrame.size());
+}
+
+void WebView::FlushMessages()
+{
+	if ( !m_bIsWebviewMessagesChannelsInitialized )
+	{
+		//stays queued until the page can receive it
+		return;
+	}
+
+	//one snapshot per flush no matter how often the slots were published in between
+	m_vDataChannelSnapshot.clear();
+	if ( m_dataChannel.AppendChangedSlots( m_vDataChannelSnapshot ))
+	{
+		SendBinary( DataChannel::k_usFrameType, m_vDataChannelSnapshot.data(), (uint32_t) m_vDataChannelSnapshot.size());
+	}
+
+	{
+		std::scoped_lock<std::mutex> lock( m_mutMessageQueueMutex );
+		if ( m_sQueuedMessages.empty())
 		{
-			std::scoped_lock<std::mutex> lock2( m_mutPixelBuffer );
-			env->CallVoidMethod( m_webViewInfo.bitmap, m_WVTmBitmapCopyPixelsToBuffer, m_buffer );
+			return;
 		}
+	}
+
+	gApp->uiThreadCallbackHandler->postCoalesced( UIThreadCallbackHandler::MakeTaskKey( this, UI_THREAD_TASK_FLUSH_MESSAGES ),
+												  [pWeak = GetWeakPtr()]()
+												  {
+													  if ( auto pWebView = pWeak.lock() )
+													  {
+														  pWebView->UIThread_FlushMessages();
+													  }
+												  } );
+}
+
+void WebView::UIThread_FlushMessages()
+{
+	if ( !m_bIsWebviewMessagesChannelsInitialized || !m_bIsRunning )
+	{
+		return;
+	}
+
+	//both buffers keep their capacity, so queueing doesn't allocate once they have grown
+	{
+		std::scoped_lock<std::mutex> lock( m_mutMessageQueueMutex );
+		std::swap( m_sQueuedMessages, m_sFlushingMessages );
+	}
 
-		env->CallObjectMethod( m_buffer, m_WVTmBufferRewind );
+	if ( m_sFlushingMessages.empty())
+	{
+		return;
 	}
 
-	m_bIsDrawing = false;
+	SETUP_FOR_JAVA_CALL
+
+	env->PushLocalFrame( 4 );
+
+	jstring jsMessages = env->NewStringUTF( m_sFlushingMessages.c_str());
+	jobject webMessage = env->NewObject( m_WVTcWebMessage, m_WVTmWebMessageInit, jsMessages );
+	env->CallVoidMethod( m_webViewInfo.messagePort, m_WVTmWebMessagePortPostMessage, webMessage );
+
+	env->PopLocalFrame( nullptr );
+
+	m_sFlushingMessages.clear();
+}
+
+void WebView::SetRenderScale( float fRenderScale )
+{
+	m_fRequestedRenderScale.store( std::clamp( fRenderScale, k_fMinRenderScale, 1.f ), std::memory_order_relaxed );
 }
 
 void WebView::RequestDraw()
 {
-	if ( m_bIsDrawing )
+	//a frame is as old as the first request it satisfies
+	uint64_t ulNoRequest = 0;
+	m_ulDrawRequestTimeUS.compare_exchange_strong( ulNoRequest, GetCurrentTimeUS());
+
+	//requests made while a draw is still queued are coalesced into it
+	gApp->uiThreadCallbackHandler->postCoalesced( UIThreadCallbackHandler::MakeTaskKey( this, UI_THREAD_TASK_DRAW ),
+												  [pWeak = GetWeakPtr()]()
+												  {
+													  if ( auto pWebView = pWeak.lock() )
+													  {
+														  pWebView->UIThread_Draw();
+													  }
+												  } );
+}
+
+void WebView::QueuePointerEvent( EPointerAction eAction, float fX, float fY )
+{
+	const PointerEvent event = {
+			.eAction = eAction,
+			.fX = fX,
+			.fY = fY,
+			.ulEventTimeUS = GetUptimeUS(),
+	};
+
+	if ( !m_queuePointerEvents.BPush( event ))
+	{
+		//only happens if the UI thread has been stuck for seconds, a lost move is harmless but a lost press isn't
+		if ( m_unDroppedPointerEvents++ == 0 || ( eAction != POINTER_ACTION_MOVE && eAction != POINTER_ACTION_HOVER_MOVE ))
+		{
+			Log( LogWarning, "[WebView] Pointer event queue full, dropped %u events so far", m_unDroppedPointerEvents );
+		}
+	}
+}
+
+void WebView::FlushPointerEvents()
+{
+	if ( m_queuePointerEvents.BIsEmpty())
 	{
 		return;
 	}
 
-	gApp->uiThreadCallbackHandler->post([pWeak = GetWeakPtr()]()
-										 {
-											 if ( auto pWebView = pWeak.lock() )
-											 {
-												 pWebView->UIThread_Draw();
-											 }
-										 } );
+	gApp->uiThreadCallbackHandler->postCoalesced( UIThreadCallbackHandler::MakeTaskKey( this, UI_THREAD_TASK_DISPATCH_POINTER_EVENTS ),
+												  [pWeak = GetWeakPtr()]()
+												  {
+													  if ( auto pWebView = pWeak.lock() )
+													  {
+														  pWebView->UIThread_DispatchPointerEvents();
+													  }
+												  } );
+}
+
+void WebView::UIThread_DispatchPointerEvents()
+{
+	if ( !m_bIsWebViewSetup || !m_bIsRunning )
+	{
+		return;
+	}
+
+	//keeps its capacity, so dispatching doesn't allocate once it has grown
+	m_vDispatchingPointerEvents.clear();
+	PointerEvent event;
+	while ( m_queuePointerEvents.BPop( event ))
+	{
+		m_vDispatchingPointerEvents.push_back( event );
+	}
+
+	SETUP_FOR_JAVA_CALL
+
+	//presses, releases, enters and exits go out on their own, runs of moves become one event with historical samples
+	const uint32_t unEventCount = (uint32_t) m_vDispatchingPointerEvents.size();
+	uint32_t unRunStart = 0;
+	while ( unRunStart < unEventCount )
+	{
+		const EPointerAction eAction = m_vDispatchingPointerEvents[ unRunStart ].eAction;
+		uint32_t unRunEnd = unRunStart + 1;
+		if ( eAction == POINTER_ACTION_MOVE || eAction == POINTER_ACTION_HOVER_MOVE )
+		{
+			while ( unRunEnd < unEventCount && m_vDispatchingPointerEvents[ unRunEnd ].eAction == eAction )
+			{
+				unRunEnd++;
+			}
+		}
+
+		UIThread_DispatchMotionEvent( env, &m_vDispatchingPointerEvents[ unRunStart ], unRunEnd - unRunStart );
+		unRunStart = unRunEnd;
+	}
+}
+
+void WebView::UIThread_DispatchMotionEvent( JNIEnv *env, const PointerEvent *pEvents, uint32_t unCount )
+{
+	const PointerEvent &first = pEvents[ 0 ];
+	const PointerEvent &latest = pEvents[ unCount - 1 ];
+	const bool bIsHover = first.eAction >= POINTER_ACTION_HOVER_ENTER;
+
+	//MotionEvent times are in milliseconds and must never go backwards, even when samples share a millisecond
+	auto GetEventTimeMS = [this]( const PointerEvent &event )
+	{
+		m_lLastPointerEventTimeMS = std::max( m_lLastPointerEventTimeMS, (int64_t) ( event.ulEventTimeUS / 1000 ));
+		return (jlong) m_lLastPointerEventTimeMS;
+	};
+
+	if ( first.eAction == POINTER_ACTION_DOWN )
+	{
+		m_lPointerDownTimeMS = GetEventTimeMS( first );
+	}
+
+	//velocity only follows hovering, it starts over whenever the pointer enters, presses or leaves
+	if ( first.eAction == POINTER_ACTION_HOVER_ENTER || first.eAction == POINTER_ACTION_HOVER_MOVE )
+	{
+		for ( uint32_t i = 0; i < unCount; i++ )
+		{
+			const PointerEvent &sample = pEvents[ i ];
+			const uint64_t ulGapUS = sample.ulEventTimeUS - m_lastPointerMoveSample.ulEventTimeUS;
+			if ( !m_bHasPointerMoveSample || ulGapUS > k_ulMaxPointerVelocityGapUS )
+			{
+				m_fPointerVelocityX = 0.f;
+				m_fPointerVelocityY = 0.f;
+			}
+			else if ( ulGapUS > 0 )
+			{
+				m_fPointerVelocityX = m_fPointerVelocityX * .5f + .5f * ( sample.fX - m_lastPointerMoveSample.fX ) / (float) ulGapUS;
+				m_fPointerVelocityY = m_fPointerVelocityY * .5f + .5f * ( sample.fY - m_lastPointerMoveSample.fY ) / (float) ulGapUS;
+			}
+
+			m_lastPointerMoveSample = sample;
+			m_bHasPointerMoveSample = true;
+		}
+	}
+	else
+	{
+		m_bHasPointerMoveSample = false;
+	}
+
+	//every real sample goes out untouched, the one created with becomes the oldest once more are batched onto it
+	const jlong lFirstTimeMS = GetEventTimeMS( first );
+
+	env->PushLocalFrame( 2 );
+
+	jobject motionEvent = env->CallStaticObjectMethod( m_WVTcMotionEvent, m_WVTmMotionEventObtain,
+														(jlong) ( bIsHover ? lFirstTimeMS : m_lPointerDownTimeMS ), lFirstTimeMS,
+														k_anMotionEventActions[ first.eAction ], first.fX, first.fY, 0 );
+	env->CallVoidMethod( motionEvent, m_WVTmMotionEventSetSource, bIsHover ? k_nInputSourceMouse : k_nInputSourceTouchscreen );
+
+	for ( uint32_t i = 1; i < unCount; i++ )
+	{
+		env->CallVoidMethod( motionEvent, m_WVTmMotionEventAddBatch, GetEventTimeMS( pEvents[ i ] ),
+							 pEvents[ i ].fX, pEvents[ i ].fY, 1.f, 1.f, 0 );
+	}
+
+	//touch streams are never predicted, a VelocityTracker would take a predicted sample for a real one and fling
+	//too far, and the next real sample would pull the pointer back. Hover has no velocity tracking, so its newest
+	//position is followed by where it should be at the next draw, stamped at that time. Later real samples are
+	//not pushed forward to it
+	if ( first.eAction == POINTER_ACTION_HOVER_MOVE )
+	{
+		float fPredictedX, fPredictedY;
+		uint64_t ulPredictedTimeUS;
+		if ( UIThread_PredictPointer( latest, fPredictedX, fPredictedY, ulPredictedTimeUS ))
+		{
+			env->CallVoidMethod( motionEvent, m_WVTmMotionEventAddBatch,
+								 (jlong) std::max( m_lLastPointerEventTimeMS, (int64_t) ( ulPredictedTimeUS / 1000 )),
+								 fPredictedX, fPredictedY, 1.f, 1.f, 0 );
+		}
+	}
+
+	//hover only ever arrives as a generic motion event, the page sees it as the mouse moving
+	env->CallBooleanMethod( m_webViewInfo.webView,
+							bIsHover ? m_WVTmViewDispatchGenericMotionEvent : m_WVTmViewDispatchTouchEvent,
+							motionEvent );
+	env->CallVoidMethod( motionEvent, m_WVTmMotionEventRecycle );
+
+	env->PopLocalFrame( nullptr );
+}
+
+bool WebView::UIThread_PredictPointer( const PointerEvent &latest, float &fOutX, float &fOutY, uint64_t &ulOutTimeUS ) const
+{
+	if ( !m_bHasPointerMoveSample )
+	{
+		return false;
+	}
+
+	//the page handles the move right away and its result shows up in the first draw after that
+	const uint64_t ulTimeNowUS = GetCurrentTimeUS();
+	const uint64_t ulNextDrawUS = std::max( m_ulLastDrawRequestHandledTimeUS + m_ulDrawRequestIntervalEstimateUS, ulTimeNowUS );
+	const uint64_t ulUptimeNowUS = GetUptimeUS();
+	const uint64_t ulSampleAgeUS = ulUptimeNowUS - std::min( latest.ulEventTimeUS, ulUptimeNowUS );
+	const uint64_t ulHorizonUS = std::min( ulSampleAgeUS + ( ulNextDrawUS - ulTimeNowUS ), k_ulMaxPointerPredictionUS );
+	if ( ulHorizonUS == 0 )
+	{
+		return false;
+	}
+
+	fOutX = latest.fX + m_fPointerVelocityX * (float) ulHorizonUS;
+	fOutY = latest.fY + m_fPointerVelocityY * (float) ulHorizonUS;
+	ulOutTimeUS = latest.ulEventTimeUS + ulHorizonUS;
+	return true;
 }
 
 void WebView::UIThread_PauseWebView()
@@ -480,20 +1296,151 @@ void WebView::RequestResume()
 }
 
 
-void WebView::CopyContentsToTexture( GLuint texture )
+void WebView::CopyContentsToTexture( GLuint texture, int32_t nX, int32_t nY )
 {
 	if ( !m_bIsWebviewMessagesChannelsInitialized )
 	{
 		return;
 	}
 
+	const uint64_t ulStartTimeUS = GetCurrentTimeUS();
+
+	const uint64_t ulDrawRequestTimeUS = m_eCaptureMode == WEBVIEW_CAPTURE_MODE_SURFACE_TEXTURE ?
+										 CopySurfaceContentsToTexture( texture, nX, nY ) :
+										 CopyBufferedContentsToTexture( texture, nX, nY );
+
+	const uint64_t ulTimeNowUS = GetCurrentTimeUS();
+	m_frameStats.Record( PANEL_FRAME_STAGE_UPLOAD, ulTimeNowUS - ulStartTimeUS );
+	if ( ulDrawRequestTimeUS != 0 )
+	{
+		m_frameStats.Record( PANEL_FRAME_STAGE_FRAME_AGE, ulTimeNowUS - ulDrawRequestTimeUS );
+	}
+
+	if ( ++m_unFrameStatsFrames == k_unFrameStatsLogIntervalFrames )
+	{
+		m_frameStats.LogSummary( "WebView" );
+		m_frameStats.Reset();
+		m_unFrameStatsFrames = 0;
+	}
+}
+
+uint64_t WebView::CopyBufferedContentsToTexture( GLuint texture, int32_t nX, int32_t nY )
+{
+	const uint64_t ulUploadedBytes = m_pPixelBufferRing->UploadToTexture( m_pContentTexture->GetGLTexture());
+	m_ulLastUploadedBytes = ulUploadedBytes;
+	m_bHasContent = m_bHasContent || ulUploadedBytes > 0;
+
+	uint64_t ulDrawRequestTimeUS = 0;
+	if ( ulUploadedBytes > 0 )
+	{
+		m_frameStats.Record( PANEL_FRAME_STAGE_HANDOFF, m_pPixelBufferRing->GetLastHandoffLatencyUS());
+		ulDrawRequestTimeUS = m_pPixelBufferRing->GetLastFrameTimeUS();
+		m_fCopiedRenderScale = m_afContentRenderScales[ m_pPixelBufferRing->GetLastFrameId() % k_unContentRenderScaleHistory ]
+				.load( std::memory_order_relaxed );
+	}
+
+	m_ulUploadStatsBytes += ulUploadedBytes;
+	if ( ++m_unUploadStatsFrames == k_unUploadStatsLogIntervalFrames )
+	{
+		const uint64_t ulSupersededFrames = m_pPixelBufferRing->GetSupersededFrameCount();
+
+		Log( "[WebView] Uploaded %.1f KB/frame on average over the last %u frames, %" PRIu64 " frames superseded before upload",
+			 (double) m_ulUploadStatsBytes / m_unUploadStatsFrames / 1024.0, m_unUploadStatsFrames,
+			 ulSupersededFrames - m_ulUploadStatsSupersededFrames );
+
+		m_ulUploadStatsBytes = 0;
+		m_unUploadStatsFrames = 0;
+		m_ulUploadStatsSupersededFrames = ulSupersededFrames;
+	}
+
+	if ( !m_bHasContent )
+	{
+		return 0;
+	}
+
+	//swapchain images rotate, so each one is refreshed from the persistent content texture on the GPU,
+	//only the part the scaled content covers is ever shown
+	GL_CHECK( glCopyImageSubData( m_pContentTexture->GetGLTexture(), GL_TEXTURE_2D, 0, 0, 0, 0,
+								  texture, GL_TEXTURE_2D, 0, nX, nY, 0,
+								  GetScaledExtent( m_webViewInfo.nWidth, m_fCopiedRenderScale ),
+								  GetScaledExtent( m_webViewInfo.nHeight, m_fCopiedRenderScale ), 1 ));
+
+	return ulDrawRequestTimeUS;
+}
+
+void WebView::LatchContent()
+{
+	if ( m_eCaptureMode != WEBVIEW_CAPTURE_MODE_SURFACE_TEXTURE || !m_bIsWebviewMessagesChannelsInitialized )
+	{
+		return;
+	}
+
+	//posting a hardware canvas only syncs the draw, the buffer is queued into the surface later by the render
+	//thread, so a generation only counts as latched once updateTexImage actually moved to a newer buffer
+	const uint64_t ulPostedGeneration = m_ulContentGeneration.load( std::memory_order_acquire );
+	if ( ulPostedGeneration == m_ulLatchedContentGeneration )
+	{
+		return;
+	}
+
+	SETUP_FOR_JAVA_CALL
+
+	const uint64_t ulPreviousGeneration = m_ulLatchedContentGeneration;
+	while ( m_ulLatchedContentGeneration < ulPostedGeneration )
+	{
+		env->CallVoidMethod( m_webViewInfo.surfaceTexture, m_WVTmSurfaceTextureUpdateTexImage );
+		const int64_t lTimestampNS = env->CallLongMethod( m_webViewInfo.surfaceTexture, m_WVTmSurfaceTextureGetTimestamp );
+		if ( lTimestampNS == m_lLatchedSurfaceTimestampNS )
+		{
+			//not queued yet, picked up on a later frame
+			break;
+		}
+
+		m_lLatchedSurfaceTimestampNS = lTimestampNS;
+		m_ulLatchedContentGeneration++;
+	}
+
+	if ( m_ulLatchedContentGeneration == ulPreviousGeneration )
+	{
+		return;
+	}
+
+	env->CallVoidMethod( m_webViewInfo.surfaceTexture, m_WVTmSurfaceTextureGetTransformMatrix, m_WVTjvSurfaceTextureTransform );
+	env->GetFloatArrayRegion( m_WVTjvSurfaceTextureTransform, 0, 16, &m_matSurfaceTextureTransform[ 0 ][ 0 ] );
+
+	m_fLatchedRenderScale = m_afContentRenderScales[ m_ulLatchedContentGeneration % k_unContentRenderScaleHistory ]
+			.load( std::memory_order_relaxed );
+
+	m_bHasContent = true;
+
+	//may already belong to a frame posted after the one latched, close enough for stats
+	m_frameStats.Record( PANEL_FRAME_STAGE_HANDOFF, GetCurrentTimeUS() - m_ulSurfacePublishTimeUS );
+	m_ulLatchedDrawRequestTimeUS = m_ulSurfaceDrawRequestTimeUS;
+}
+
+uint64_t WebView::CopySurfaceContentsToTexture( GLuint texture, int32_t nX, int32_t nY )
+{
+	//frames are latched by LatchContent, this only draws whatever is in the external texture
+	const uint64_t ulDrawRequestTimeUS = m_ulLatchedDrawRequestTimeUS;
+	m_ulLatchedDrawRequestTimeUS = 0;
+	m_fCopiedRenderScale = m_fLatchedRenderScale;
+
+	if ( !m_bHasContent )
 	{
-		std::scoped_lock<std::mutex> lock( m_mutPixelBuffer );
-		GL_CHECK( glBindTexture( GL_TEXTURE_2D, texture ));
-		GL_CHECK( glTexSubImage2D( GL_TEXTURE_2D, 0, 0, 0, m_webViewInfo.nWidth, m_webViewInfo.nHeight, GL_RGBA,
-								   GL_UNSIGNED_BYTE, m_bufferbytes ));
-		GL_CHECK( glBindTexture( GL_TEXTURE_2D, 0 ));
+		return 0;
 	}
+
+	//samples just the scaled content in the top left of the surface and draws it into the same corner of the target.
+	//surface texture input space starts at the bottom left, so the scale is anchored to its top edge
+	const float fScale = m_fCopiedRenderScale;
+	const glm::mat4 matContentTransform = m_matSurfaceTextureTransform *
+										  glm::translate( glm::mat4( 1.f ), glm::vec3( 0.f, 1.f - fScale, 0.f )) *
+										  glm::scale( glm::mat4( 1.f ), glm::vec3( fScale, fScale, 1.f ));
+	m_pSurfaceRenderer->RenderToTexture( glm::mat4( 1.f ), glm::mat4( 1.f ), m_pSurfaceTexture, texture,
+										 GetScaledExtent( m_webViewInfo.nWidth, m_fCopiedRenderScale ),
+										 GetScaledExtent( m_webViewInfo.nHeight, m_fCopiedRenderScale ), matContentTransform, nX, nY );
+
+	return ulDrawRequestTimeUS;
 }
 
 void WebView::CopyDebugContentsToTexture(GLuint texture) {
@@ -503,7 +1450,6 @@ void WebView::CopyDebugContentsToTexture(GLuint texture) {
     }
 
     {
-        std::scoped_lock<std::mutex> lock( m_mutPixelBuffer );
         GL_CHECK( glBindTexture( GL_TEXTURE_2D, texture ));
 
 		for(unsigned int i = 0; i < m_webViewInfo.nWidth * m_webViewInfo.nHeight; i++) {
@@ -533,6 +1479,8 @@ WebView::~WebView()
 
 		if ( m_bIsRunning.exchange( false ))
 		{
+			NotifyStateChanged();
+
 			if ( m_webViewInfo.looper )
 			{
 				jclass cLooper = env->FindClass( "android/os/Looper" );
@@ -551,12 +1499,38 @@ WebView::~WebView()
 		env->DeleteGlobalRef( m_webViewInfo.canvas );
 		env->DeleteGlobalRef( m_webViewInfo.webView );
 		env->DeleteGlobalRef( m_webViewInfo.looper );
-		env->DeleteGlobalRef( m_buffer );
 
 		env->DeleteGlobalRef( m_WVTcWebView );
 		env->DeleteGlobalRef( m_WVTcCanvas );
 		env->DeleteGlobalRef( m_WVTcBitmap );
-		env->DeleteGlobalRef( m_WVTcByteBuffer );
+		env->DeleteGlobalRef( m_WVTcMotionEvent );
+
+		m_pPixelBufferRing = nullptr;
+		m_pContentTexture = nullptr;
+
+		if ( m_webViewInfo.surface )
+		{
+			jclass cSurface = env->FindClass( "android/view/Surface" );
+			jmethodID mRelease = env->GetMethodID( cSurface, "release", "()V" );
+			env->CallVoidMethod( m_webViewInfo.surface, mRelease );
+		}
+
+		if ( m_webViewInfo.surfaceTexture )
+		{
+			jclass cSurfaceTexture = env->FindClass( "android/graphics/SurfaceTexture" );
+			jmethodID mRelease = env->GetMethodID( cSurfaceTexture, "release", "()V" );
+			env->CallVoidMethod( m_webViewInfo.surfaceTexture, mRelease );
+		}
+
+		env->DeleteGlobalRef( m_webViewInfo.messagePort );
+		env->DeleteGlobalRef( m_WVTcWebMessage );
+
+		env->DeleteGlobalRef( m_webViewInfo.surface );
+		env->DeleteGlobalRef( m_webViewInfo.surfaceTexture );
+		env->DeleteGlobalRef( m_WVTjvSurfaceTextureTransform );
+
+		m_pSurfaceRenderer = nullptr;
+		m_pSurfaceTexture = nullptr;
 
 		free( m_bufferbytes );
 	}
@@ -1,12 +1,19 @@
 #pragma once
 
+#include <array>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include "android_native_app_glue.h"
 
 #include "glutils.h"
+#include "framestats.h"
+#include "binaryframes.h"
+#include "datachannel.h"
+#include "spscqueue.h"
 
+#include <condition_variable>
 #include <thread>
-#include <queue>
 
 struct WebViewInfo
 {
@@ -14,38 +21,116 @@ struct WebViewInfo
 	jobject bitmap = nullptr;
 	jobject webView = nullptr;
 	jobjectArray messageChannels = nullptr;
+	jobject messagePort = nullptr;
 	jobject looper = nullptr;
 
+	//only used when capturing through a surface texture
+	jobject surfaceTexture = nullptr;
+	jobject surface = nullptr;
+
 	int32_t nWidth = 0;
 	int32_t nHeight = 0;
 
 	std::string sBaseUrl;
 };
 
-struct WebViewInput
-{
-	std::string sInput;
-};
+//smallest scale a webview can be drawn at, below this text stops being recognisable anyway
+static constexpr float k_fMinRenderScale = 0.125f;
+
+//pixels along one side of a capture drawn at fRenderScale
+int32_t GetScaledExtent( int32_t nExtent, float fRenderScale );
 
-struct WebViewOutput
+//what a pointer did, mapped onto MotionEvent actions when dispatched. Presses go out as touch events, hovering
+//as mouse hover events
+enum EPointerAction
 {
-	std::string sOutput;
+	POINTER_ACTION_DOWN,
+	POINTER_ACTION_MOVE,
+	POINTER_ACTION_UP,
+	POINTER_ACTION_CANCEL,
+	POINTER_ACTION_HOVER_ENTER,
+	POINTER_ACTION_HOVER_MOVE,
+	POINTER_ACTION_HOVER_EXIT,
 };
 
+//called on the webview thread with the data of a message sent to its mailbox, only valid during the call
+using MailboxHandler = std::function<void( std::string_view sData )>;
+
+//called on the webview thread with a frame of a binary message, the payload is only valid during the call
+using BinaryHandler = std::function<void( const BinaryFrame &frame )>;
+
 class WebView: public std::enable_shared_from_this<WebView> {
 public:
-	static std::shared_ptr<WebView> Create( int32_t nWidth, int32_t nHeight, std::string sBaseUrl );
+	static std::shared_ptr<WebView> Create( int32_t nWidth, int32_t nHeight, std::string sBaseUrl,
+											EWebViewCaptureMode eCaptureMode = WEBVIEW_CAPTURE_MODE_SOFTWARE );
 
 	std::shared_ptr<WebView> GetPtr() { return shared_from_this(); }
 	std::weak_ptr<WebView> GetWeakPtr() { return weak_from_this(); }
 
-	//assumes that texture is the same size as the webview
-	void CopyContentsToTexture( GLuint texture );
+	//writes the content into the webview sized rect at nX, nY of texture, leaving the rest of it untouched
+	void CopyContentsToTexture( GLuint texture, int32_t nX = 0, int32_t nY = 0 );
+
+	//bytes streamed to the GPU by the last CopyContentsToTexture call
+	uint64_t GetLastUploadedBytes() const { return m_ulLastUploadedBytes; }
+
+	//timings of every stage a frame goes through between RequestDraw and the panel texture
+	const PanelFrameStats &GetFrameStats() const { return m_frameStats; }
+
+	//bumped every time the UI thread publishes a frame with changed content. in surface texture mode it only
+	//counts frames LatchContent has latched, so call this on the render thread after it
+	uint64_t GetContentGeneration() const
+	{
+		return m_eCaptureMode == WEBVIEW_CAPTURE_MODE_SURFACE_TEXTURE ? m_ulLatchedContentGeneration :
+			   m_ulContentGeneration.load( std::memory_order_acquire );
+	}
+
+	//render thread, once a frame: latches the surface frames whose buffers have arrived, even while nothing is copied
+	void LatchContent();
+
+	//draws the page scaled down into the top left of the capture, the layout keeps its size so nothing reflows
+	void SetRenderScale( float fRenderScale );
+
+	//scale the content written by the last CopyContentsToTexture was drawn at, it fills that fraction of the texture
+	float GetContentRenderScale() const { return m_fCopiedRenderScale; }
 
     void CopyDebugContentsToTexture( GLuint texture );
 
+	//callers cap the rate, the draw itself is skipped on the UI thread unless the webview was invalidated or its
+	//window redrew since the last draw
 	void RequestDraw();
 
+	//true while a requested draw hasn't been picked up by the UI thread yet
+	bool BIsDrawPending() const { return m_ulDrawRequestTimeUS.load( std::memory_order_relaxed ) != 0; }
+
+	//how long a draw usually keeps the UI thread busy, averaged over recent draws
+	uint64_t GetDrawCostEstimateUS() const { return m_ulDrawCostEstimateUS.load( std::memory_order_relaxed ); }
+
+	//messages from the page are "<mailbox> <data>", handlers should be registered before the page starts sending
+	bool RegisterMailboxHandler( std::string sMailboxName, MailboxHandler handler );
+
+	//can be called from any thread, messages are queued until the next FlushMessages. neither may contain the
+	//'\x1e' separator messages are batched with or a null, nor the mailbox name a space, such messages are dropped
+	void SendMessage( std::string_view sMailboxName, std::string_view sData );
+
+	//frames from the page arrive as an ArrayBuffer, see binaryframes.h for the format
+	void RegisterBinaryHandler( uint16_t usType, BinaryHandler handler );
+
+	//can be called from any thread, queued and flushed with the string messages
+	void SendBinary( uint16_t usType, const void *pData, uint32_t unLength );
+
+	//latest-value slots the page polls once per animation frame, any changes are sent along with FlushMessages
+	DataChannel &GetDataChannel() { return m_dataChannel; }
+
+	//posts everything sent since the last flush to the page as a single web message, call once per frame
+	void FlushMessages();
+
+	//lock free, but only one thread may queue at a time. The position is in webview pixels. Every sample is kept,
+	//the UI thread batches runs of moves into a single MotionEvent
+	void QueuePointerEvent( EPointerAction eAction, float fX, float fY );
+
+	//hands everything queued since the last flush to the UI thread as one task, call once per frame
+	void FlushPointerEvents();
+
 	void RequestPause();
 
 	void RequestResume();
@@ -56,41 +141,178 @@ public:
 
 private:
 
-	WebView( int32_t nWidth, int32_t nHeight, std::string sBaseUrl );
+	WebView( int32_t nWidth, int32_t nHeight, std::string sBaseUrl, EWebViewCaptureMode eCaptureMode );
 
 	WebView() = delete;
 
+	bool CreateSurfaceTexture();
+
+	//these return the RequestDraw time of the frame they picked up, 0 if there was no new frame
+	uint64_t CopyBufferedContentsToTexture( GLuint texture, int32_t nX, int32_t nY );
+
+	uint64_t CopySurfaceContentsToTexture( GLuint texture, int32_t nX, int32_t nY );
+
 	void WebViewThread();
 
+	//wakes the webview thread after one of the flags it waits on changed
+	void NotifyStateChanged();
+
+	//reflection for the classes web messages arrive as, resolved once per class on the webview thread
+	struct WebMessageClassInfo
+	{
+		jclass cClass = nullptr;
+
+		//set if the message object carries the raw message bytes itself
+		jfieldID fMessageBytes = nullptr;
+
+		//otherwise the message object may be a Pair holding a payload with the message string
+		bool bIsPair = false;
+		jclass cPayloadClass = nullptr;
+		jfieldID fPayloadString = nullptr;
+
+		//set on payloads that can carry an ArrayBuffer
+		jfieldID fPayloadBytes = nullptr;
+	};
+
+	WebMessageClassInfo &WVT_GetWebMessageClassInfo( JNIEnv *env, jobject messageObject, jclass cPair );
+
+	void WVT_ResolveWebMessagePayloadFields( JNIEnv *env, WebMessageClassInfo &classInfo, jobject messagePayload );
+
+	void WVT_DispatchMessages( std::string_view sMessages );
+
+	void WVT_DispatchBinaryMessage( JNIEnv *env, jbyteArray jvMessage );
+
+	struct MailboxRegistration
+	{
+		std::string sName;
+		std::shared_ptr<const MailboxHandler> pHandler;
+	};
+
 	void UIThread_SetupWebView();
 
 	void UIThread_InitializeMessageChannels();
 
 	void UIThread_Draw();
 
+	void UIThread_PublishDamage( uint64_t ulDrawRequestTimeUS, float fRenderScale );
+
+	//records the scale of the new content and bumps the content generation, returns the new generation
+	uint64_t UIThread_PublishContentGeneration( float fRenderScale );
+
+	void UIThread_DrawWebView( JNIEnv *env, jobject canvas, float fRenderScale );
+
+	void UIThread_DrawToBitmap( JNIEnv *env, uint64_t ulDrawRequestTimeUS, float fRenderScale );
+
+	void UIThread_DrawToSurface( JNIEnv *env, uint64_t ulDrawRequestTimeUS, float fRenderScale );
+
+	void UIThread_FlushMessages();
+
+	struct PointerEvent
+	{
+		EPointerAction eAction;
+		float fX;
+		float fY;
+
+		//SystemClock.uptimeMillis() time base, in microseconds so velocities survive fast samples
+		uint64_t ulEventTimeUS;
+	};
+
+	void UIThread_DispatchPointerEvents();
+
+	//dispatches unCount events of the same action as one MotionEvent, all but the last as historical samples
+	void UIThread_DispatchMotionEvent( JNIEnv *env, const PointerEvent *pEvents, uint32_t unCount );
+
+	//where a hovering pointer will be by the time the page's response shows up in a draw, and when that is.
+	//false if there is no velocity to predict from
+	bool UIThread_PredictPointer( const PointerEvent &latest, float &fOutX, float &fOutY, uint64_t &ulOutTimeUS ) const;
+
 	void UIThread_PauseWebView();
 
 	void UIThread_ResumeWebView();
 
 	WebViewInfo m_webViewInfo;
 
-    uint8_t *m_bufferbytes = nullptr;
-	jobject m_buffer = nullptr;
+	//only used by the debug contents path
+	uint8_t *m_bufferbytes = nullptr;
+
+	//only tiles that changed since the last draw are copied into mapped unpack buffers and streamed into
+	//the content texture on the render thread
+	std::unique_ptr<DamageTracker> m_pDamageTracker;
+	std::unique_ptr<PixelBufferRing> m_pPixelBufferRing;
+	std::unique_ptr<Texture> m_pContentTexture;
+	bool m_bHasContent = false;
+
+	EWebViewCaptureMode m_eCaptureMode;
+
+	//surface texture path: frames are latched into the external texture on the render thread and drawn straight
+	//into the target texture
+	std::unique_ptr<Texture> m_pSurfaceTexture;
+	std::unique_ptr<PanelRenderer> m_pSurfaceRenderer;
+	glm::mat4 m_matSurfaceTextureTransform = glm::mat4( 1.f );
+	uint64_t m_ulLatchedContentGeneration = 0;
+	int64_t m_lLatchedSurfaceTimestampNS = 0;
+	uint64_t m_ulLatchedDrawRequestTimeUS = 0;
+	float m_fLatchedRenderScale = 1.f;
+	std::atomic<uint64_t> m_ulSurfacePublishTimeUS = 0;
+	std::atomic<uint64_t> m_ulSurfaceDrawRequestTimeUS = 0;
+
+	std::atomic<uint64_t> m_ulContentGeneration = 0;
+
+	//render scale of recent content generations, indexed by generation, so the render thread knows the scale of
+	//whichever frame it ends up copying
+	static constexpr uint32_t k_unContentRenderScaleHistory = 8;
+	std::array<std::atomic<float>, k_unContentRenderScaleHistory> m_afContentRenderScales;
+
+	std::atomic<float> m_fRequestedRenderScale = 1.f;
+	float m_fDrawnRenderScale = 1.f;
+	float m_fCopiedRenderScale = 1.f;
+
+	std::atomic<uint64_t> m_ulLastUploadedBytes = 0;
+	uint64_t m_ulUploadStatsBytes = 0;
+	uint32_t m_unUploadStatsFrames = 0;
+	uint64_t m_ulUploadStatsSupersededFrames = 0;
+
+	PanelFrameStats m_frameStats;
+	uint32_t m_unFrameStatsFrames = 0;
 
 	jclass m_WVTcWebView = nullptr;
 	jclass m_WVTcCanvas = nullptr;
 	jclass m_WVTcBitmap = nullptr;
-	jclass m_WVTcByteBuffer = nullptr;
 
 	jmethodID m_WVTmWebviewDraw = nullptr;
 	jmethodID m_WVTmCanvasDrawColor = nullptr;
-	jmethodID m_WVTmBitmapCopyPixelsToBuffer = nullptr;
-	jmethodID m_WVTmBufferRewind = nullptr;
+	jmethodID m_WVTmCanvasSave = nullptr;
+	jmethodID m_WVTmCanvasRestore = nullptr;
+	jmethodID m_WVTmCanvasScale = nullptr;
+	jmethodID m_WVTmViewIsDirty = nullptr;
+	jmethodID m_WVTmViewGetDrawingTime = nullptr;
+
+	jmethodID m_WVTmSurfaceLockHardwareCanvas = nullptr;
+	jmethodID m_WVTmSurfaceUnlockCanvasAndPost = nullptr;
+	jmethodID m_WVTmSurfaceTextureUpdateTexImage = nullptr;
+	jmethodID m_WVTmSurfaceTextureGetTransformMatrix = nullptr;
+	jmethodID m_WVTmSurfaceTextureGetTimestamp = nullptr;
+
+	jfloatArray m_WVTjvSurfaceTextureTransform = nullptr;
+
+	jmethodID m_WVTmClassGetName = nullptr;
+	std::vector<WebMessageClassInfo> m_vWVTWebMessageClasses;
+	std::vector<char> m_vWVTMessageBytes;
+	std::vector<uint8_t> m_vWVTBinaryMessageBytes;
+
+	jclass m_WVTcWebMessage = nullptr;
+	jmethodID m_WVTmWebMessageInit = nullptr;
+	jmethodID m_WVTmWebMessagePortPostMessage = nullptr;
 
 	jobject m_WVToPorterDuffClear = nullptr;
 
-	std::queue<WebViewInput> m_inputQueue;
-	std::queue<WebViewOutput> m_outputQueue;
+	jclass m_WVTcMotionEvent = nullptr;
+	jmethodID m_WVTmMotionEventObtain = nullptr;
+	jmethodID m_WVTmMotionEventSetSource = nullptr;
+	jmethodID m_WVTmMotionEventRecycle = nullptr;
+	jmethodID m_WVTmMotionEventAddBatch = nullptr;
+	jmethodID m_WVTmViewDispatchTouchEvent = nullptr;
+	jmethodID m_WVTmViewDispatchGenericMotionEvent = nullptr;
 
 	std::thread m_webViewThread;
 	std::atomic<bool> m_bIsRunning = false;
@@ -99,11 +321,60 @@ private:
 
 	std::atomic<bool> m_bIsWebviewMessagesChannelsInitialized = false;
 
-	std::atomic<bool> m_bIsDrawing = false;
+	std::mutex m_mutState;
+	std::condition_variable m_cvState;
+
+	//time of the oldest RequestDraw not yet picked up by a draw, 0 if there is none
+	std::atomic<uint64_t> m_ulDrawRequestTimeUS = 0;
+
+	//written on the UI thread after every draw, starts pessimistic until real draws have been measured
+	std::atomic<uint64_t> m_ulDrawCostEstimateUS = 4000;
+
+	//only touched on the UI thread
+	uint64_t m_ulLastDrawTimeUS = 0;
+	int64_t m_lDrawnWindowDrawingTimeMS = 0;
+	uint64_t m_ulLastDrawRequestHandledTimeUS = 0;
+	uint64_t m_ulDrawRequestIntervalEstimateUS = 16667;
+	uint32_t m_unDrawStatsRequests = 0;
+	uint32_t m_unDrawStatsDraws = 0;
 
 	std::mutex m_mutWebView;
-	std::mutex m_mutPixelBuffer;
+
+	//keyed by the hash of the mailbox name. handlers are shared so they can be called after the lock is dropped,
+	//which lets them register handlers themselves
+	std::mutex m_mutMailboxHandlers;
+	std::unordered_map<uint64_t, MailboxRegistration> m_mapMailboxHandlers;
+	std::unordered_map<uint16_t, std::shared_ptr<const BinaryHandler>> m_mapBinaryHandlers;
+
+	//next sequence expected from the page for each frame type, only touched on the webview thread
+	std::unordered_map<uint16_t, uint32_t> m_mapWVTBinarySequences;
 
 	std::mutex m_mutMessageQueueMutex;
-	std::vector<std::string> m_vMessagesQueuedForWebViewReady{};
+	std::string m_sQueuedMessages;
+	std::string m_sFlushingMessages;
+	std::vector<uint8_t> m_vQueuedBinaryFrame;
+	std::unordered_map<uint16_t, uint32_t> m_mapBinarySequences;
+
+	//a few seconds of samples even if the UI thread stalls, anything beyond that is dropped
+	SPSCQueue<PointerEvent, 256> m_queuePointerEvents;
+
+	//only touched by the thread queueing pointer events
+	uint32_t m_unDroppedPointerEvents = 0;
+
+	//only touched on the UI thread
+	std::vector<PointerEvent> m_vDispatchingPointerEvents;
+	int64_t m_lPointerDownTimeMS = 0;
+	int64_t m_lLastPointerEventTimeMS = 0;
+
+	//smoothed over the real samples since the pointer started hovering, in pixels per microsecond, only touched
+	//on the UI thread
+	bool m_bHasPointerMoveSample = false;
+	PointerEvent m_lastPointerMoveSample{};
+	float m_fPointerVelocityX = 0.f;
+	float m_fPointerVelocityY = 0.f;
+
+	DataChannel m_dataChannel;
+
+	//only touched by the thread calling FlushMessages
+	std::vector<uint8_t> m_vDataChannelSnapshot;
 };
\ No newline at end of file
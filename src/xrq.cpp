@@ -1,5 +1,7 @@
 #include "xrq.h"
 
+#include <algorithm>
+#include <cinttypes>
 #include <vector>
 
 #include "check.h"
@@ -8,6 +10,7 @@
 #include <unistd.h>
 
 #include "log.h"
+#include "timeutils.h"
 
 extern EGLDisplay egl_display;
 extern EGLContext egl_context;
@@ -391,6 +394,89 @@ XRQCreateSwapchain( const XRQContext &context, const XRQSwapchainInfo &xrqSwapch
 	return true;
 }
 
+//space left between atlas rects, so filtering at the edge of one layer never picks up its neighbour
+static const int32_t k_nSwapchainAtlasGutter = 2;
+
+bool XRQCreateSwapchainAtlas( const XRQContext &context, const XRQSwapchainInfo &xrqSwapchainInfo, XRQSwapchainAtlas &outAtlas )
+{
+	if ( !XRQCreateSwapchain( context, xrqSwapchainInfo, outAtlas.swapchain ))
+	{
+		Log( LogError, "[XRQ] XRQCreateSwapchainAtlas could not create the atlas swapchain" );
+		return false;
+	}
+
+	outAtlas.vShelves.clear();
+
+	Log( "[XRQ] Created %ix%i swapchain atlas", outAtlas.swapchain.width, outAtlas.swapchain.height );
+	return true;
+}
+
+bool XRQAllocateSwapchainAtlasRect( XRQSwapchainAtlas &atlas, int32_t nWidth, int32_t nHeight, XrRect2Di &outRect )
+{
+	const int32_t nPaddedWidth = nWidth + k_nSwapchainAtlasGutter;
+	const int32_t nPaddedHeight = nHeight + k_nSwapchainAtlasGutter;
+	if ( nPaddedWidth > atlas.swapchain.width || nPaddedHeight > atlas.swapchain.height )
+	{
+		return false;
+	}
+
+	//the shelf wasting the least height wins, an empty shelf can be retaken at any height that fits
+	XRQSwapchainAtlas::Shelf *pBestShelf = nullptr;
+	for ( XRQSwapchainAtlas::Shelf &shelf: atlas.vShelves )
+	{
+		if ( shelf.unAllocations == 0 )
+		{
+			shelf.nUsedWidth = 0;
+		}
+
+		if ( shelf.nHeight < nPaddedHeight || atlas.swapchain.width - shelf.nUsedWidth < nPaddedWidth )
+		{
+			continue;
+		}
+
+		if ( !pBestShelf || shelf.nHeight < pBestShelf->nHeight )
+		{
+			pBestShelf = &shelf;
+		}
+	}
+
+	if ( !pBestShelf )
+	{
+		const int32_t nTop = atlas.vShelves.empty() ? 0 : atlas.vShelves.back().nY + atlas.vShelves.back().nHeight;
+		if ( atlas.swapchain.height - nTop < nPaddedHeight )
+		{
+			return false;
+		}
+
+		atlas.vShelves.push_back( {.nY = nTop, .nHeight = nPaddedHeight} );
+		pBestShelf = &atlas.vShelves.back();
+	}
+
+	outRect = {
+			.offset = {.x = pBestShelf->nUsedWidth, .y = pBestShelf->nY},
+			.extent = {.width = nWidth, .height = nHeight},
+	};
+
+	pBestShelf->nUsedWidth += nPaddedWidth;
+	pBestShelf->unAllocations++;
+
+	return true;
+}
+
+void XRQFreeSwapchainAtlasRect( XRQSwapchainAtlas &atlas, const XrRect2Di &rect )
+{
+	for ( XRQSwapchainAtlas::Shelf &shelf: atlas.vShelves )
+	{
+		if ( shelf.nY == rect.offset.y && shelf.unAllocations > 0 )
+		{
+			shelf.unAllocations--;
+			return;
+		}
+	}
+
+	Log( LogWarning, "[XRQ] XRQFreeSwapchainAtlasRect: rect at %i,%i is not in the atlas", rect.offset.x, rect.offset.y );
+}
+
 bool XRQGetSwapchainSamplerStateGLES( const XRQContext &context, XRQSwapchain &swapchain,
 									  XrSwapchainStateSamplerOpenGLESFB &samplerState )
 {
@@ -543,13 +629,18 @@ static bool SetupFaceTracking( XRQContext &context )
 	return true;
 }
 
-static bool SetupSocialEyeTracking( XRQContext &context )
+bool XRQCreateEyeTracker( XRQContext &context )
 {
 	if ( !context.bIsSocialEyeTrackingSupported )
 	{
 		return false;
 	}
 
+	if ( context.eyeTracker != XR_NULL_HANDLE )
+	{
+		return true;
+	}
+
 	XrEyeTrackerCreateInfoFB eyeTrackerCreateInfoFb = {
 			.type = XR_TYPE_EYE_TRACKER_CREATE_INFO_FB,
 			.next = nullptr
@@ -645,11 +736,6 @@ bool XRQCreateXRSession( XRQContext &outContext )
 		XRQCreateReferenceSpace( outContext, referenceSpaceType );
 	}
 
-	if ( !SetupSocialEyeTracking( outContext ))
-	{
-		Log( LogWarning, "[XRQ] XRQCreateXRSession: Unable to setup social eye tracking" );
-	}
-
 	if ( !SetupFaceTracking( outContext ))
 	{
 		Log( LogWarning, "[XRQ] XRQCreateXRSession: Unable to setup face tracking" );
@@ -892,6 +978,71 @@ bool XRQLocateViewsFrame( XRQContext &context )
 	return true;
 }
 
+void XRQHandJointCache::Publish()
+{
+	m_unLatestIndex = m_unWriteIndex;
+	m_unWriteIndex = m_unExchange.exchange( m_unWriteIndex | k_unFreshBit, std::memory_order_acq_rel ) & k_unIndexMask;
+}
+
+const XRQHandJointsSnapshot &XRQHandJointCache::TakeLatest()
+{
+	if ( m_unExchange.load( std::memory_order_relaxed ) & k_unFreshBit )
+	{
+		m_unReadIndex = m_unExchange.exchange( m_unReadIndex, std::memory_order_acq_rel ) & k_unIndexMask;
+	}
+
+	return m_aSnapshots[ m_unReadIndex ];
+}
+
+bool XRQLocateHandJointsFrame( XRQContext &context )
+{
+	XRQHandJointsSnapshot &snapshot = context.handJoints.GetWriteSnapshot();
+	snapshot.time = context.currentFrameState.predictedDisplayTime;
+
+	const bool bIsAimAvailable = XRQIsExtensionAvailable( context, XR_FB_HAND_TRACKING_AIM_EXTENSION_NAME );
+
+	//the runtime only fills joints in as an array of structs, they get split up into the snapshot's arrays below
+	std::array<XrHandJointLocationEXT, XR_HAND_JOINT_COUNT_EXT> jointLocations;
+	bool bSucceeded = true;
+	for ( int i = 0; i < 2; i++ )
+	{
+		XRQHandJoints &hand = snapshot.aHands[ i ];
+		hand.bIsActive = false;
+		hand.bIsAimValid = false;
+		hand.aimState = {.type = XR_TYPE_HAND_TRACKING_AIM_STATE_FB, .next = nullptr};
+
+		XrHandJointLocationsEXT handJointLocations = {
+				.type = XR_TYPE_HAND_JOINT_LOCATIONS_EXT,
+				.next = bIsAimAvailable ? &hand.aimState : nullptr,
+				.jointCount = XR_HAND_JOINT_COUNT_EXT,
+				.jointLocations = jointLocations.data(),
+		};
+		if ( !XRQLocateHandJoints( context, (XRQHand) i, snapshot.time, handJointLocations ))
+		{
+			//not being set up is expected when there is no hand tracking, only failed locates count as failing
+			bSucceeded = bSucceeded && !context.bIsHandTrackingSetup;
+			continue;
+		}
+
+		hand.bIsActive = handJointLocations.isActive;
+		hand.bIsAimValid = bIsAimAvailable && hand.bIsActive && ( hand.aimState.status & XR_HAND_TRACKING_AIM_VALID_BIT_FB );
+		hand.aimState.next = nullptr;
+
+		for ( uint32_t unJoint = 0; unJoint < XR_HAND_JOINT_COUNT_EXT; unJoint++ )
+		{
+			const XrHandJointLocationEXT &joint = jointLocations[ unJoint ];
+			hand.aPositions[ unJoint ] = joint.pose.position;
+			hand.aOrientations[ unJoint ] = joint.pose.orientation;
+			hand.afRadii[ unJoint ] = joint.radius;
+			hand.aLocationFlags[ unJoint ] = hand.bIsActive ? joint.locationFlags : 0;
+		}
+	}
+
+	context.handJoints.Publish();
+
+	return bSucceeded;
+}
+
 bool XRQGetTimeNow( const XRQContext &context, XrTime &out_time )
 {
 	if ( !XRQIsExtensionAvailable( context, XR_KHR_CONVERT_TIMESPEC_TIME_EXTENSION_NAME ))
@@ -1027,6 +1178,293 @@ XRQAcquireSwapchainImageRAII::~XRQAcquireSwapchainImageRAII()
 	XRQReleaseSwapchain( m_swapchain );
 }
 
+//a stalled compositor costs the frame at most this long, after that its layers are skipped rather than hanging the
+//render thread
+static const XrDuration k_xrSwapchainWaitTimeoutNS = 50000000;
+
+static const uint32_t k_unSwapchainStatsLogIntervalFrames = 600;
+
+int32_t XRQFrameSwapchainScheduler::Acquire( const XRQSwapchain &swapchain, const char *sName )
+{
+	static const XrSwapchainImageAcquireInfo acquire_info = {
+			.type = XR_TYPE_SWAPCHAIN_IMAGE_ACQUIRE_INFO,
+			.next = nullptr,
+	};
+
+	AcquiredImage image = {.pSwapchain = &swapchain};
+
+	//an image that timed out is still acquired, it has to be waited on and released before the next one
+	auto itCarried = std::find_if( m_vCarriedImages.begin(), m_vCarriedImages.end(), [ &swapchain ]( const AcquiredImage &carried )
+	{
+		return carried.pSwapchain == &swapchain;
+	} );
+	if ( itCarried != m_vCarriedImages.end())
+	{
+		image = *itCarried;
+		m_vCarriedImages.erase( itCarried );
+	}
+	else
+	{
+		XrResult result = xrAcquireSwapchainImage( swapchain.swapchain, &acquire_info, &image.unImageIndex );
+		if ( XR_FAILED( result ))
+		{
+			Log( LogError, "[XRQ] Failed to acquire image of swapchain %s: %i", sName, result );
+			return -1;
+		}
+	}
+
+	auto it = std::find_if( m_vStats.begin(), m_vStats.end(), [ &swapchain ]( const SwapchainStats &stats )
+	{
+		return stats.swapchain == swapchain.swapchain;
+	} );
+	if ( it == m_vStats.end())
+	{
+		m_vStats.push_back( {.swapchain = swapchain.swapchain, .sName = sName} );
+		it = m_vStats.end() - 1;
+	}
+	it->unAcquires++;
+	image.unStats = (uint32_t) ( it - m_vStats.begin());
+
+	m_vAcquiredImages.push_back( image );
+	return (int32_t) m_vAcquiredImages.size() - 1;
+}
+
+bool XRQFrameSwapchainScheduler::BWaitForImage( AcquiredImage &image, XrDuration timeout )
+{
+	if ( image.bReady || image.bFailed || image.bTimedOut )
+	{
+		return image.bReady;
+	}
+
+	const XrSwapchainImageWaitInfo wait_info = {
+			.type = XR_TYPE_SWAPCHAIN_IMAGE_WAIT_INFO,
+			.next = nullptr,
+			.timeout = timeout,
+	};
+
+	//a timed out wait leaves the image acquired, it is carried over and waited on again next frame
+	XrResult result = xrWaitSwapchainImage( image.pSwapchain->swapchain, &wait_info );
+	if ( result == XR_TIMEOUT_EXPIRED )
+	{
+		Log( LogWarning, "[XRQ] Gave up waiting on swapchain %s for this frame", m_vStats[ image.unStats ].sName );
+		image.bTimedOut = true;
+		m_bGaveUpThisFrame = true;
+		return false;
+	}
+
+	if ( XR_FAILED( result ))
+	{
+		Log( LogError, "[XRQ] Failed to wait on image of swapchain %s: %i", m_vStats[ image.unStats ].sName, result );
+		image.bFailed = true;
+		return false;
+	}
+
+	image.bReady = true;
+	return true;
+}
+
+GLuint XRQFrameSwapchainScheduler::WaitForImage( int32_t nHandle )
+{
+	if ( nHandle < 0 || nHandle >= (int32_t) m_vAcquiredImages.size())
+	{
+		return 0;
+	}
+
+	AcquiredImage &image = m_vAcquiredImages[ nHandle ];
+	SwapchainStats &stats = m_vStats[ image.unStats ];
+
+	const uint64_t ulStartTimeUS = GetCurrentTimeUS();
+	//once the compositor has stalled one image the rest of the frame only takes images that are ready already
+	BWaitForImage( image, m_bGaveUpThisFrame ? 0 : k_xrSwapchainWaitTimeoutNS );
+
+	const uint64_t ulBlockedUS = GetCurrentTimeUS() - ulStartTimeUS;
+	stats.ulBlockedUS += ulBlockedUS;
+	stats.ulMaxBlockedUS = std::max( stats.ulMaxBlockedUS, ulBlockedUS );
+
+	return image.bReady ? image.pSwapchain->images[ image.unImageIndex ].image : 0;
+}
+
+void XRQFrameSwapchainScheduler::ReleaseAll()
+{
+	static const XrSwapchainImageReleaseInfo release_info = {
+			.type = XR_TYPE_SWAPCHAIN_IMAGE_RELEASE_INFO,
+			.next = nullptr,
+	};
+
+	for ( int32_t nHandle = 0; nHandle < (int32_t) m_vAcquiredImages.size(); nHandle++ )
+	{
+		AcquiredImage &image = m_vAcquiredImages[ nHandle ];
+		if ( !image.bReady && !image.bFailed && !image.bTimedOut )
+		{
+			WaitForImage( nHandle );
+		}
+
+		if ( image.bTimedOut )
+		{
+			//still held by the compositor, releasing it unwaited isn't allowed and dropping it would leak it
+			image.bTimedOut = false;
+			m_vCarriedImages.push_back( image );
+			continue;
+		}
+
+		//a failed wait usually means the session or swapchain is gone, the release tells the runtime the image
+		//is abandoned either way, it is not tracked any further
+		XrResult result = xrReleaseSwapchainImage( image.pSwapchain->swapchain, &release_info );
+		if ( XR_FAILED( result ))
+		{
+			Log( LogError, "[XRQ] Failed to release image of swapchain %s: %i", m_vStats[ image.unStats ].sName, result );
+		}
+		else if ( image.bFailed )
+		{
+			Log( LogWarning, "[XRQ] Released image of swapchain %s after its wait failed", m_vStats[ image.unStats ].sName );
+		}
+	}
+
+	m_vAcquiredImages.clear();
+	m_bGaveUpThisFrame = false;
+
+	if ( ++m_unStatsFrames == k_unSwapchainStatsLogIntervalFrames )
+	{
+		LogStats();
+	}
+}
+
+void XRQFrameSwapchainScheduler::LogStats()
+{
+	for ( SwapchainStats &stats: m_vStats )
+	{
+		if ( stats.unAcquires > 0 )
+		{
+			Log( "[XRQ] Swapchain %s: %u acquires over the last %u frames, blocked %.1fus on average and %" PRIu64 "us at most",
+				 stats.sName, stats.unAcquires, m_unStatsFrames, (double) stats.ulBlockedUS / stats.unAcquires, stats.ulMaxBlockedUS );
+		}
+
+		stats.ulBlockedUS = 0;
+		stats.ulMaxBlockedUS = 0;
+		stats.unAcquires = 0;
+	}
+
+	m_unStatsFrames = 0;
+}
+
+void XRQFramePacer::Start( const XRQContext &context )
+{
+	if ( BIsRunning())
+	{
+		return;
+	}
+
+	m_eState = PACER_STATE_WAITING;
+	m_bStopRequested = false;
+
+	//the pacing thread only reads the session handles and extensions, which don't change while it runs
+	m_thread = std::thread( &XRQFramePacer::ThreadMain, this, &context );
+
+	Log( "[XRQ] Frame pacing thread started" );
+}
+
+static bool WaitFrameState( const XRQContext &context, XrFrameState &outFrameState )
+{
+	outFrameState = {.type = XR_TYPE_FRAME_STATE, .next = nullptr};
+	XrFrameWaitInfo frame_wait_info = {.type = XR_TYPE_FRAME_WAIT_INFO, .next = nullptr};
+	QUALIFY_XR( context, xrWaitFrame( context.session, &frame_wait_info, &outFrameState ));
+
+	return true;
+}
+
+void XRQFramePacer::ThreadMain( const XRQContext *pContext )
+{
+	XRQSetApplicationThread( *pContext, XR_ANDROID_THREAD_TYPE_APPLICATION_MAIN_KHR );
+
+	while ( true )
+	{
+		{
+			std::unique_lock<std::mutex> lock( m_mutex );
+			m_cv.wait( lock, [ this ]
+			{
+				return m_bStopRequested || m_eState == PACER_STATE_WAITING;
+			} );
+
+			if ( m_bStopRequested )
+			{
+				break;
+			}
+		}
+
+		XrFrameState frameState;
+		if ( !WaitFrameState( *pContext, frameState ))
+		{
+			Log( LogError, "[XRQ] Frame pacing thread failed to wait on a frame, exiting" );
+			break;
+		}
+
+		std::lock_guard<std::mutex> lock( m_mutex );
+		m_frameState = frameState;
+		m_eState = PACER_STATE_FRAME_READY;
+		m_cv.notify_all();
+	}
+
+	std::lock_guard<std::mutex> lock( m_mutex );
+	m_eState = PACER_STATE_EXITED;
+	m_cv.notify_all();
+}
+
+bool XRQFramePacer::BTakeFrame( XRQContext &context, uint64_t ulTimeoutUS )
+{
+	std::unique_lock<std::mutex> lock( m_mutex );
+	m_cv.wait_for( lock, std::chrono::microseconds( ulTimeoutUS ), [ this ]
+	{
+		return m_eState == PACER_STATE_FRAME_READY || m_eState == PACER_STATE_EXITED;
+	} );
+
+	if ( m_eState == PACER_STATE_EXITED )
+	{
+		lock.unlock();
+		Stop();
+		return false;
+	}
+
+	if ( m_eState != PACER_STATE_FRAME_READY )
+	{
+		return false;
+	}
+
+	context.currentFrameState = m_frameState;
+	m_eState = PACER_STATE_FRAME_TAKEN;
+	return true;
+}
+
+void XRQFramePacer::FrameBegun()
+{
+	std::lock_guard<std::mutex> lock( m_mutex );
+	if ( m_eState == PACER_STATE_FRAME_TAKEN )
+	{
+		m_eState = PACER_STATE_WAITING;
+		m_cv.notify_all();
+	}
+}
+
+void XRQFramePacer::Stop()
+{
+	if ( !BIsRunning())
+	{
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock( m_mutex );
+		m_bStopRequested = true;
+		m_cv.notify_all();
+	}
+
+	m_thread.join();
+	Log( "[XRQ] Frame pacing thread stopped" );
+}
+
+XRQFramePacer::~XRQFramePacer()
+{
+	Stop();
+}
 
 XrPath XRQStringToXrPath( XrInstance instance, const std::string &path )
 {
@@ -1374,6 +1812,51 @@ bool XRQGetFaceTracking( XRQContext &context, XrFaceExpressionWeights2FB &outFac
 	return true;
 }
 
+bool XRQLocateEyeGaze( const XRQContext &context, XrTime time, XrPosef &outGazePose, float &outConfidence )
+{
+	if ( context.eyeTracker == XR_NULL_HANDLE )
+	{
+		return false;
+	}
+
+	XrSpace baseSpace;
+	XRQGetReferenceSpace( context, context.playSpace, baseSpace );
+
+	XrEyeGazesInfoFB eyeGazesInfo = {
+			.type = XR_TYPE_EYE_GAZES_INFO_FB,
+			.next = nullptr,
+			.baseSpace = baseSpace,
+			.time = time,
+	};
+	XrEyeGazesFB eyeGazes = {
+			.type = XR_TYPE_EYE_GAZES_FB,
+			.next = nullptr,
+	};
+	QUALIFY_XR( context, xrGetEyeGazesFB( context.eyeTracker, &eyeGazesInfo, &eyeGazes ));
+
+	const XrEyeGazeFB &leftGaze = eyeGazes.gaze[ XR_EYE_POSITION_LEFT_FB ];
+	const XrEyeGazeFB &rightGaze = eyeGazes.gaze[ XR_EYE_POSITION_RIGHT_FB ];
+	if ( !leftGaze.isValid && !rightGaze.isValid )
+	{
+		return false;
+	}
+
+	if ( !leftGaze.isValid || !rightGaze.isValid )
+	{
+		const XrEyeGazeFB &gaze = leftGaze.isValid ? leftGaze : rightGaze;
+		outGazePose = gaze.gazePose;
+		outConfidence = gaze.gazeConfidence;
+		return true;
+	}
+
+	//a ray from between the eyes halfway between both gazes
+	XrVector3f_Lerp( &outGazePose.position, &leftGaze.gazePose.position, &rightGaze.gazePose.position, .5f );
+	XrQuaternionf_Lerp( &outGazePose.orientation, &leftGaze.gazePose.orientation, &rightGaze.gazePose.orientation, .5f );
+	outConfidence = std::min( leftGaze.gazeConfidence, rightGaze.gazeConfidence );
+
+	return true;
+}
+
 bool XRQEnumerateColorSpaces( const XRQContext& context, std::vector<XrColorSpaceFB>& vOutColorSpaces )
 {
 	if( !XRQIsExtensionAvailable(context, XR_FB_COLOR_SPACE_EXTENSION_NAME) )
@@ -1445,6 +1928,64 @@ bool XRQLocateHandJoints( XRQContext& context, XRQHand hand, XrTime time, XrHand
 	return true;
 }
 
+static int32_t GetActionSubactionIndex( const XRQContext &context, const XRQAction &action, XRQHand hand )
+{
+	if ( action.vecSubactionPaths.empty())
+	{
+		return 0;
+	}
+
+	const XrPath subactionPath = XRQGetSubactionPathForHand( context, hand );
+	for ( int32_t i = 0; i < (int32_t) action.vecSubactionPaths.size(); i++ )
+	{
+		if ( action.vecSubactionPaths[ i ] == subactionPath )
+		{
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+bool XRQLocateActionSpace( XRQContext &context, const XRQAction &action, XRQHand hand, XrTime time, XrSpaceLocation &outSpaceLocation )
+{
+	const int32_t nIndex = GetActionSubactionIndex( context, action, hand );
+	if ( nIndex < 0 || nIndex >= (int32_t) action.vecActionSpaces.size())
+	{
+		Log( LogError, "[XRQ] XRQLocateActionSpace: Action %s has no space for hand %i", action.sActionName.c_str(), hand );
+		return false;
+	}
+
+	XrSpace baseSpace;
+	XRQGetReferenceSpace( context, context.playSpace, baseSpace );
+
+	QUALIFY_XR( context, xrLocateSpace( action.vecActionSpaces[ nIndex ], baseSpace, time, &outSpaceLocation ));
+
+	return true;
+}
+
+bool XRQGetActionStateFloat( const XRQContext &context, const XRQAction &action, XRQHand hand, XrActionStateFloat &outState )
+{
+	const int32_t nIndex = GetActionSubactionIndex( context, action, hand );
+	if ( nIndex < 0 )
+	{
+		Log( LogError, "[XRQ] XRQGetActionStateFloat: Action %s was not created for hand %i", action.sActionName.c_str(), hand );
+		return false;
+	}
+
+	XrActionStateGetInfo getInfo = {
+			.type = XR_TYPE_ACTION_STATE_GET_INFO,
+			.next = nullptr,
+			.action = action.action,
+			.subactionPath = action.vecSubactionPaths.empty() ? XR_NULL_PATH : action.vecSubactionPaths[ nIndex ],
+	};
+
+	outState = {.type = XR_TYPE_ACTION_STATE_FLOAT, .next = nullptr};
+	QUALIFY_XR( context, xrGetActionStateFloat( context.session, &getInfo, &outState ));
+
+	return true;
+}
+
 bool XRQIsLocationValid( const XrSpaceLocationFlags locationFlags )
 {
 	return locationFlags & XR_SPACE_LOCATION_ORIENTATION_VALID_BIT &&
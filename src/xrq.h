@@ -1,11 +1,14 @@
 #pragma once
 
 #include <array>
+#include <atomic>
 #include <vector>
 #include <string>
 #include <set>
 #include <map>
 #include <mutex>
+#include <condition_variable>
+#include <thread>
 #include <variant>
 
 #define EGL_EGLEXT_PROTOTYPES 1
@@ -81,6 +84,23 @@ struct XRQSwapchain
 	~XRQSwapchain();
 };
 
+// One large swapchain that many small quad layers share, each layer pointing at its own imageRect.
+// Rects are packed into horizontal shelves; a shelf is handed back for reuse once everything in it has been freed.
+struct XRQSwapchainAtlas
+{
+	XRQSwapchain swapchain;
+
+	struct Shelf
+	{
+		int32_t nY = 0;
+		int32_t nHeight = 0;
+		int32_t nUsedWidth = 0;
+		uint32_t unAllocations = 0;
+	};
+
+	std::vector<Shelf> vShelves;
+};
+
 struct XRQActionSetCreateInfo
 {
 	std::string sActionSetName;
@@ -112,6 +132,62 @@ struct XRQActionCreateInfo
 	std::map<std::string, std::vector<std::string>> mapInteractionProfileBindings;
 };
 
+// One hand's joints in the play space, each property in its own array so a pass over one of them stays in cache.
+struct XRQHandJoints
+{
+	bool bIsActive = false;
+
+	std::array<XrVector3f, XR_HAND_JOINT_COUNT_EXT> aPositions = {};
+	std::array<XrQuaternionf, XR_HAND_JOINT_COUNT_EXT> aOrientations = {};
+	std::array<float, XR_HAND_JOINT_COUNT_EXT> afRadii = {};
+	std::array<XrSpaceLocationFlags, XR_HAND_JOINT_COUNT_EXT> aLocationFlags = {};
+
+	//located along with the joints, only set if XR_FB_hand_tracking_aim is enabled and reported a valid aim
+	bool bIsAimValid = false;
+	XrHandTrackingAimStateFB aimState = {};
+};
+
+struct XRQHandJointsSnapshot
+{
+	//predicted display time the hands were located at, 0 if they never were
+	XrTime time = 0;
+
+	std::array<XRQHandJoints, 2> aHands;
+};
+
+// Both hands located once per frame, shared by everything that looks at them that frame.
+// Snapshots rotate through three buffers, so the thread locating the hands and a single other thread reading them
+// never wait on each other and the reader never sees a snapshot that is being written.
+class XRQHandJointCache
+{
+public:
+	// Locating thread only, the buffer to fill before calling Publish.
+	XRQHandJointsSnapshot &GetWriteSnapshot() { return m_aSnapshots[ m_unWriteIndex ]; }
+
+	// Locating thread only.
+	void Publish();
+
+	// Locating thread only, the snapshot published last.
+	const XRQHandJointsSnapshot &GetLatest() const { return m_aSnapshots[ m_unLatestIndex ]; }
+
+	// Reading thread only. Newest published snapshot, stays valid and unchanged until the next call.
+	const XRQHandJointsSnapshot &TakeLatest();
+
+private:
+	static constexpr uint32_t k_unIndexMask = 3;
+	static constexpr uint32_t k_unFreshBit = 4;
+
+	std::array<XRQHandJointsSnapshot, 3> m_aSnapshots;
+
+	uint32_t m_unWriteIndex = 0;
+	uint32_t m_unLatestIndex = 1;
+
+	//index of the buffer between the two threads, with k_unFreshBit set while the reader hasn't taken it
+	std::atomic<uint32_t> m_unExchange = 1;
+
+	uint32_t m_unReadIndex = 2;
+};
+
 struct XRQContext
 {
 	XrInstance instance = XR_NULL_HANDLE;
@@ -154,6 +230,7 @@ struct XRQContext
 	std::atomic< bool > bIsHandTrackingSetup = false;
 	std::array< bool, 2 > vHandTrackingDataReceived = { false, false };
 	std::array< XrHandTrackerEXT, 2 > handTracker = {XR_NULL_HANDLE, XR_NULL_HANDLE};
+	XRQHandJointCache handJoints;
 
 	std::vector<XrActionSet> vecActionSets;
 	std::map<XrPath, std::vector<XrActionSuggestedBinding>> mapInteractionProfileBindings;
@@ -190,9 +267,20 @@ bool XRQCreateXRSession( XRQContext &outContext );
 
 bool XRQCreateHandTrackers( XRQContext& context );
 
+// The runtime refuses to create the tracker until the app has been granted the eye tracking permission, does nothing
+// if it already exists
+bool XRQCreateEyeTracker( XRQContext &context );
+
 bool
 XRQCreateSwapchain( const XRQContext &context, const XRQSwapchainInfo &xrqSwapchainInfo, XRQSwapchain &outSwapchain );
 
+bool XRQCreateSwapchainAtlas( const XRQContext &context, const XRQSwapchainInfo &xrqSwapchainInfo, XRQSwapchainAtlas &outAtlas );
+
+// Returns false if the atlas has no room left for a rect of the given size.
+bool XRQAllocateSwapchainAtlasRect( XRQSwapchainAtlas &atlas, int32_t nWidth, int32_t nHeight, XrRect2Di &outRect );
+
+void XRQFreeSwapchainAtlasRect( XRQSwapchainAtlas &atlas, const XrRect2Di &rect );
+
 bool XRQGetSwapchainSamplerStateGLES( const XRQContext &context, XRQSwapchain &swapchain,
 									  XrSwapchainStateSamplerOpenGLESFB &samplerState );
 
@@ -213,6 +301,9 @@ bool XRQGetTimeNow( const XRQContext &context, XrTime &out_time );
 
 bool XRQLocateViewsFrame( XRQContext &context );
 
+// Locates both hands at the current frame's predicted display time into context.handJoints
+bool XRQLocateHandJointsFrame( XRQContext &context );
+
 bool
 XRQLocateViewsInReferenceSpace( const XRQContext &context, XrTime time, XrSpace space, std::vector<XrView> &vOutViews );
 
@@ -261,6 +352,111 @@ private:
 	XrSwapchain m_swapchain = XR_NULL_HANDLE;
 };
 
+// Frame-scoped swapchain image handling. Every image a frame needs is acquired up front, CPU work can run while
+// the compositor is still done with them, and the waits happen only once an image is about to be written. All
+// images are released in one pass before xrEndFrame. Time spent blocked is tracked per swapchain.
+class XRQFrameSwapchainScheduler
+{
+public:
+	// Acquires the next image of the swapchain, returns a handle valid until ReleaseAll or -1 on failure.
+	// If the swapchain still has an image that was given up on in an earlier frame, that image is handed out again.
+	// sName must outlive the scheduler, it is only used for stats.
+	int32_t Acquire( const XRQSwapchain &swapchain, const char *sName );
+
+	// Waits until the image is writable and returns its texture. Returns 0 if the wait failed or the compositor
+	// didn't hand the image back in time, in which case nothing should be drawn or submitted from it this frame.
+	GLuint WaitForImage( int32_t nHandle );
+
+	// Releases every image acquired this frame, waiting first on any that were never waited on. Images that timed
+	// out stay acquired and are carried over to the next Acquire of their swapchain.
+	void ReleaseAll();
+
+private:
+	struct AcquiredImage
+	{
+		const XRQSwapchain *pSwapchain = nullptr;
+		uint32_t unImageIndex = 0;
+		bool bReady = false;
+		bool bFailed = false;
+		bool bTimedOut = false;
+		uint32_t unStats = 0;
+	};
+
+	struct SwapchainStats
+	{
+		XrSwapchain swapchain = XR_NULL_HANDLE;
+		const char *sName = nullptr;
+		uint64_t ulBlockedUS = 0;
+		uint64_t ulMaxBlockedUS = 0;
+		uint32_t unAcquires = 0;
+	};
+
+	bool BWaitForImage( AcquiredImage &image, XrDuration timeout );
+
+	void LogStats();
+
+	std::vector<AcquiredImage> m_vAcquiredImages;
+	std::vector<AcquiredImage> m_vCarriedImages;
+	std::vector<SwapchainStats> m_vStats;
+	bool m_bGaveUpThisFrame = false;
+
+	uint32_t m_unStatsFrames = 0;
+};
+
+// Owns xrWaitFrame on a thread of its own, so the render thread doesn't block in it. The pacing thread waits on
+// the next frame as soon as the render thread has begun the current one, which overlaps the wait with the render
+// thread's work and submission for that frame. Between taking a frame and beginning it the pacing thread is idle,
+// so the render thread can handle events, including ending the session, without racing it.
+class XRQFramePacer
+{
+public:
+	XRQFramePacer() = default;
+
+	XRQFramePacer( const XRQFramePacer & ) = delete;
+
+	XRQFramePacer &operator=( const XRQFramePacer & ) = delete;
+
+	// Starts the pacing thread, which registers itself with the runtime and waits on the first frame right away.
+	// The context has to outlive the pacing thread.
+	void Start( const XRQContext &context );
+
+	// Joins the pacing thread. Must not be called while the pacing thread could be waiting on a frame that
+	// will never come, i.e. only when it is idle or the session is still running.
+	void Stop();
+
+	bool BIsRunning() const { return m_thread.joinable(); }
+
+	// Waits up to ulTimeoutUS for the next frame and makes it the context's current frame.
+	// Returns false on timeout or if the pacing thread has exited, in which case it is joined.
+	bool BTakeFrame( XRQContext &context, uint64_t ulTimeoutUS );
+
+	// Call once xrBeginFrame has returned for the taken frame, lets the pacing thread wait on the next one.
+	void FrameBegun();
+
+	~XRQFramePacer();
+
+private:
+	enum EPacerState
+	{
+		PACER_STATE_WAITING,
+		PACER_STATE_FRAME_READY,
+		PACER_STATE_FRAME_TAKEN,
+		PACER_STATE_EXITED,
+	};
+
+	void ThreadMain( const XRQContext *pContext );
+
+	std::thread m_thread;
+
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+
+	EPacerState m_eState = PACER_STATE_WAITING;
+	bool m_bStopRequested = false;
+
+	XrFrameState m_frameState{};
+};
+
 XrPath XRQStringToXrPath( XrInstance instance, const std::string &path );
 
 XrPath XRQStringToXrPath( const XRQContext &context, const std::string &path );
@@ -290,6 +486,10 @@ bool XRQAttachRegisteredActionSets( XRQContext &context );
 
 bool XRQGetFaceTracking( XRQContext &context, XrFaceExpressionWeights2FB &outFaceExpressionWeights );
 
+// Gaze of both eyes combined, in the play space with -Z along the gaze. Returns false unless the FB eye tracker was
+// created and at least one eye is tracked, outConfidence is that of the less confident tracked eye
+bool XRQLocateEyeGaze( const XRQContext &context, XrTime time, XrPosef &outGazePose, float &outConfidence );
+
 bool XRQEnumerateColorSpaces( const XRQContext& context, std::vector<XrColorSpaceFB>& vOutColorSpaces );
 
 bool XRQSetColorSpace( const XRQContext& context, XrColorSpaceFB colorSpace );
@@ -297,6 +497,11 @@ bool XRQSetColorSpace( const XRQContext& context, XrColorSpaceFB colorSpace );
 bool XRQSetApplicationThread( const XRQContext& context, XrAndroidThreadTypeKHR threadType );
 bool XRQLocateHandJoints( XRQContext& context, XRQHand hand, XrTime time, XrHandJointLocationsEXT& outJointLocations );
 
+// hand picks the subaction path for actions created for both hands
+bool XRQLocateActionSpace( XRQContext &context, const XRQAction &action, XRQHand hand, XrTime time, XrSpaceLocation &outSpaceLocation );
+
+bool XRQGetActionStateFloat( const XRQContext &context, const XRQAction &action, XRQHand hand, XrActionStateFloat &outState );
+
 bool XRQIsLocationValid( const XrSpaceLocationFlags locationFlags );
 
 bool XRQIsVelocityValid( const XrSpaceVelocityFlags velocityFlags );
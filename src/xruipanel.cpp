@@ -10,10 +10,18 @@
 #include "log.h"
 #include "glm/gtx/vector_angle.inl"
 
-#define DEBUGPANEL
+//fills panels with a flat colour instead of the webview content
+//#define DEBUGPANEL
 #define ROTATEPANEL
 
-PanelPositionerHUD::PanelPositionerHUD(const glm::mat4 &matOffsetPosition) {
+//render scales a panel steps between, coarser ones once it covers fewer display pixels than its texture
+static const std::array<float, 5> k_afRenderScaleLevels = {1.f, 0.75f, 0.5f, 0.375f, 0.25f};
+
+//a coarser level is only picked once it has this much headroom, so a panel at the boundary doesn't flip back and forth
+static const float k_fRenderScaleHysteresis = 0.15f;
+
+PanelPositionerHUD::PanelPositionerHUD(const glm::mat4 &matOffsetPosition, bool bLockToView) :
+        m_bLockToView(bLockToView) {
     m_matOffsetPosition = matOffsetPosition;
 }
 
@@ -86,12 +94,6 @@ glm::mat4 PanelPositionerPoint::GetMatrix(const glm::mat4 &matHmdPosition) {
     return m_matPoint;
 }
 
-static uint64_t GetCurrentTimeUS() {
-    struct timespec tsp;
-    clock_gettime(CLOCK_MONOTONIC_RAW, &tsp);
-    return (uint64_t) tsp.tv_sec * 1000000LL + tsp.tv_nsec / 1000;
-}
-
 XrUIPanel::XrUIPanel(
         PanelConfig panelConfig,
         std::shared_ptr<WebView> pWebView,
@@ -103,22 +105,41 @@ XrUIPanel::XrUIPanel(
     Log("[XRUIPanel] Refresh rate: %.2f, frame time: %i", panelConfig.fRefreshRate, m_ulPanelFrameTimeUS);
 }
 
-bool XrUIPanel::Init(const XRQContext &xrqContext) {
-    Log("[XRUIPanel] Initializing UI panel swapchains...");
+bool XrUIPanel::Init(const XRQContext &xrqContext, XRQSwapchainAtlas *pAtlas) {
+    const XrReferenceSpaceType layerSpace = m_pPanelPositioner->BIsHeadLocked() ? XR_REFERENCE_SPACE_TYPE_VIEW
+                                                                                : xrqContext.playSpace;
 
-    XRQSwapchainInfo panelInfo = {
-            .width = static_cast<uint32_t>(m_panelConfig.unTextureWidth),
-            .height = static_cast<uint32_t>(m_panelConfig.unTextureHeight),
-            .recommendedFormat = GL_SRGB8_ALPHA8,
-            .sampleCount = xrqContext.vViewConfigViews[0].recommendedSwapchainSampleCount,
-    };
-    if (!XRQCreateSwapchain(xrqContext, panelInfo, m_panelSwapchain)) {
-        Log(LogError, "[XRUIPanel] Failed to create swapchain for panel!");
+    if (pAtlas) {
+        Log("[XRUIPanel] Packing UI panel into swapchain atlas...");
 
-        return false;
-    }
+        if (!XRQAllocateSwapchainAtlasRect(*pAtlas, (int32_t) m_panelConfig.unTextureWidth,
+                                           (int32_t) m_panelConfig.unTextureHeight, m_atlasRect)) {
+            Log(LogError, "[XRUIPanel] No room for panel in swapchain atlas!");
 
-    XRQCreateBasicQuadLayer(xrqContext, m_panelSwapchain, m_panelLayerQuad);
+            return false;
+        }
+
+        m_pAtlas = pAtlas;
+
+        XRQCreateBasicQuadLayer(xrqContext, pAtlas->swapchain, layerSpace, m_panelLayerQuad);
+        m_panelLayerQuad.subImage.imageRect = m_atlasRect;
+    } else {
+        Log("[XRUIPanel] Initializing UI panel swapchains...");
+
+        XRQSwapchainInfo panelInfo = {
+                .width = static_cast<uint32_t>(m_panelConfig.unTextureWidth),
+                .height = static_cast<uint32_t>(m_panelConfig.unTextureHeight),
+                .recommendedFormat = GL_SRGB8_ALPHA8,
+                .sampleCount = xrqContext.vViewConfigViews[0].recommendedSwapchainSampleCount,
+        };
+        if (!XRQCreateSwapchain(xrqContext, panelInfo, m_panelSwapchain)) {
+            Log(LogError, "[XRUIPanel] Failed to create swapchain for panel!");
+
+            return false;
+        }
+
+        XRQCreateBasicQuadLayer(xrqContext, m_panelSwapchain, layerSpace, m_panelLayerQuad);
+    }
 
     m_panelLayerQuad.layerFlags =
             XR_COMPOSITION_LAYER_BLEND_TEXTURE_SOURCE_ALPHA_BIT | XR_COMPOSITION_LAYER_UNPREMULTIPLIED_ALPHA_BIT;
@@ -135,39 +156,53 @@ void XrUIPanel::Focused() {
     m_pWebView->RequestResume();
 }
 
-XrCompositionLayerBaseHeader *XrUIPanel::RenderFrame(XRQContext &xrqContext) {
-    uint64_t timeNowUS = GetCurrentTimeUS();
-    if (timeNowUS - m_ulLastRenderTimeUS > m_ulPanelFrameTimeUS) {
-        m_pWebView->RequestDraw();
-        m_ulLastRenderTimeUS = timeNowUS;
-    }
+bool XrUIPanel::BIsDrawDue(uint64_t ulTimeNowUS, uint32_t unFrameTimes) const {
+    return ulTimeNowUS - m_ulLastRenderTimeUS > (uint64_t) m_ulPanelFrameTimeUS * unFrameTimes;
+}
 
-    XrMatrix4x4f matPanelPosition;
-    {
-        XrSpaceLocation viewSpaceLocation = {
-                .type = XR_TYPE_SPACE_LOCATION,
-                .next = nullptr,
-        };
-        XRQLocateReferenceSpaceAtFrameTime(xrqContext, XR_REFERENCE_SPACE_TYPE_VIEW, viewSpaceLocation);
+void XrUIPanel::RequestDraw(uint64_t ulTimeNowUS) {
+    //the webview only redraws when it has been invalidated or its idle heartbeat is due
+    m_pWebView->RequestDraw();
+    m_ulLastRenderTimeUS = ulTimeNowUS;
+}
 
-        XrMatrix4x4f matHmdPosition;
-        XrMatrix4x4f_CreateFromRigidTransform(&matHmdPosition, &viewSpaceLocation.pose);
+void XrUIPanel::Update(XRQContext &xrqContext) {
+    //everything sent to the page during this frame goes out as one message
+    m_pWebView->FlushMessages();
 
-        XrMatrix4x4f matPanelPositionerPosition;
-        {
-            glm::mat4 mat = m_pPanelPositioner->GetMatrix(glm::make_mat4(matHmdPosition.m));
-            memcpy(matPanelPositionerPosition.m, glm::value_ptr(mat), sizeof(XrMatrix4x4f));
-        }
+    //done every frame, also while culled, so the surface queue keeps draining
+    m_pWebView->LatchContent();
+
+    XrSpaceLocation viewSpaceLocation = {
+            .type = XR_TYPE_SPACE_LOCATION,
+            .next = nullptr,
+    };
+    XRQLocateReferenceSpaceAtFrameTime(xrqContext, XR_REFERENCE_SPACE_TYPE_VIEW, viewSpaceLocation);
 
-        matPanelPosition = matPanelPositionerPosition;
+    UpdatePose(viewSpaceLocation.pose);
+}
+
+void XrUIPanel::LateLatchPose(const XrPosef &headPose) {
+    if (m_pPanelPositioner->BIsHeadLocked()) {
+        return;
     }
 
-    XrPosef panelPose;
-    XrQuaternionf_CreateFromMatrix4x4f(&panelPose.orientation, &matPanelPosition);
+    UpdatePose(headPose);
+}
 
-    XrMatrix4x4f_GetTranslation(&panelPose.position, &matPanelPosition);
+void XrUIPanel::UpdatePose(const XrPosef &headPose) {
+    XrMatrix4x4f matHmdPosition;
+    XrMatrix4x4f_CreateFromRigidTransform(&matHmdPosition, &headPose);
 
-    m_panelLayerQuad.pose = panelPose;
+    XrMatrix4x4f matPanelPosition;
+    {
+        glm::mat4 mat = m_pPanelPositioner->GetMatrix(glm::make_mat4(matHmdPosition.m));
+        memcpy(matPanelPosition.m, glm::value_ptr(mat), sizeof(XrMatrix4x4f));
+    }
+
+    XrQuaternionf_CreateFromMatrix4x4f(&m_panelPose.orientation, &matPanelPosition);
+
+    XrMatrix4x4f_GetTranslation(&m_panelPose.position, &matPanelPosition);
 
 #ifdef ROTATEPANEL
     XrQuaternionf quatRot{};
@@ -175,22 +210,267 @@ XrCompositionLayerBaseHeader *XrUIPanel::RenderFrame(XRQContext &xrqContext) {
     XrQuaternionf_CreateFromAxisAngle(&quatRot, &vecAxis, XrDegreestoRadians(180.f));
 
     XrQuaternionf quatResult{};
-    XrQuaternionf_Multiply(&quatResult, &m_panelLayerQuad.pose.orientation, &quatRot);
+    XrQuaternionf_Multiply(&quatResult, &m_panelPose.orientation, &quatRot);
 
-    m_panelLayerQuad.pose.orientation = quatResult;
+    m_panelPose.orientation = quatResult;
 #endif
 
-    XRQAcquireSwapchainImageRAII acquiredSwapchain(m_panelSwapchain);
-    GLuint swapchainTexture = m_panelSwapchain.images[acquiredSwapchain.GetAcquiredImageIndex()].image;
+    if (m_pPanelPositioner->BIsHeadLocked()) {
+        //the layer is in VIEW space, so it only needs the offset from the head
+        XrPosef headPoseInverse;
+        XrPosef_Invert(&headPoseInverse, &headPose);
+        XrPosef_Multiply(&m_panelLayerQuad.pose, &headPoseInverse, &m_panelPose);
+    } else {
+        m_panelLayerQuad.pose = m_panelPose;
+    }
+}
+
+bool XrUIPanel::BIsInView(const XRQContext &xrqContext, float fMarginDegrees) const {
+    const XrPosef &panelPose = m_panelPose;
+    if (xrqContext.vCurrentFrameViews.empty()) {
+        return true;
+    }
+
+    //the margin is an angle, so it covers the same amount of head turn whatever the distance to the panel
+    XrVector3f vecToPanel;
+    XrVector3f_Sub(&vecToPanel, &panelPose.position, &xrqContext.vCurrentFrameViews[0].pose.position);
+    const float fMarginMeters = XrVector3f_Length(&vecToPanel) * tanf(XrDegreestoRadians(fMarginDegrees));
+
+    const float fHalfWidth = 0.5f * m_panelConfig.fWidthMeters + fMarginMeters;
+    const float fHalfHeight = 0.5f * m_panelConfig.fHeightMeters + fMarginMeters;
+    const XrVector3f vecMins = {-fHalfWidth, -fHalfHeight, -0.01f};
+    const XrVector3f vecMaxs = {fHalfWidth, fHalfHeight, 0.01f};
+
+    const XrVector3f vecScale = {1.f, 1.f, 1.f};
+    XrMatrix4x4f matModel;
+    XrMatrix4x4f_CreateTranslationRotationScale(&matModel, &panelPose.position, &panelPose.orientation, &vecScale);
+
+    for (const XrView &view: xrqContext.vCurrentFrameViews) {
+        XrMatrix4x4f matProjection;
+        XrMatrix4x4f_CreateProjectionFov(&matProjection, GRAPHICS_OPENGL_ES, view.fov, 0.05f, 100.f);
+
+        XrMatrix4x4f matViewPose;
+        XrMatrix4x4f_CreateFromRigidTransform(&matViewPose, &view.pose);
+
+        XrMatrix4x4f matView;
+        XrMatrix4x4f_InvertRigidBody(&matView, &matViewPose);
+
+        XrMatrix4x4f matViewProjection;
+        XrMatrix4x4f_Multiply(&matViewProjection, &matProjection, &matView);
+
+        XrMatrix4x4f matModelViewProjection;
+        XrMatrix4x4f_Multiply(&matModelViewProjection, &matViewProjection, &matModel);
+
+        if (!XrMatrix4x4f_CullBounds(&matModelViewProjection, &vecMins, &vecMaxs)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void XrUIPanel::UpdateRenderScale(const XRQContext &xrqContext, float fDetailScale) {
+    if (xrqContext.vCurrentFrameViews.empty() || xrqContext.vViewConfigViews.empty()) {
+        return;
+    }
+
+    const XrView &view = xrqContext.vCurrentFrameViews[0];
+
+    XrVector3f vecToPanel;
+    XrVector3f_Sub(&vecToPanel, &m_panelPose.position, &view.pose.position);
+    const float fDistance = std::max(XrVector3f_Length(&vecToPanel), 0.01f);
+
+    //display pixels per unit of tangent space around the centre of the view, a head-on panel covers size / distance of it
+    const float fPixelsPerTanX = (float) xrqContext.vViewConfigViews[0].recommendedImageRectWidth /
+                                 (tanf(view.fov.angleRight) - tanf(view.fov.angleLeft));
+    const float fPixelsPerTanY = (float) xrqContext.vViewConfigViews[0].recommendedImageRectHeight /
+                                 (tanf(view.fov.angleUp) - tanf(view.fov.angleDown));
+
+    const float fRequiredScale = fDetailScale * std::max(
+            fPixelsPerTanX * m_panelConfig.fWidthMeters / fDistance / (float) m_panelConfig.unTextureWidth,
+            fPixelsPerTanY * m_panelConfig.fHeightMeters / fDistance / (float) m_panelConfig.unTextureHeight);
+
+    //finer levels are picked straight away, coarser ones only with headroom
+    uint32_t unLevel = 0;
+    while (unLevel + 1 < k_afRenderScaleLevels.size()) {
+        const float fNextScale = k_afRenderScaleLevels[unLevel + 1];
+        const float fHeadroom = unLevel + 1 > m_unRenderScaleLevel ? 1.f + k_fRenderScaleHysteresis : 1.f;
+        if (fRequiredScale * fHeadroom > fNextScale) {
+            break;
+        }
+        unLevel++;
+    }
+
+    if (unLevel != m_unRenderScaleLevel) {
+        Log("[XRUIPanel] Render scale %.3f -> %.3f at %.2fm", k_afRenderScaleLevels[m_unRenderScaleLevel],
+            k_afRenderScaleLevels[unLevel], fDistance);
+
+        m_unRenderScaleLevel = unLevel;
+        m_pWebView->SetRenderScale(k_afRenderScaleLevels[unLevel]);
+    }
+}
+
+bool XrUIPanel::BHasNewContent() const {
+    const uint64_t ulContentGeneration = m_pWebView->GetContentGeneration();
+    return ulContentGeneration > 0 && (!m_bHasReleasedImage || ulContentGeneration != m_ulReleasedContentGeneration);
+}
+
+bool XrUIPanel::CopyToAtlas(GLuint atlasTexture) {
+    //read before copying, so a frame published while copying is picked up next time rather than missed
+    const uint64_t ulContentGeneration = m_pWebView->GetContentGeneration();
+    if (ulContentGeneration == 0) {
+        return false;
+    }
+
+    //every acquired atlas image needs every rect refreshed, the webview keeps its content around for that
+    m_pWebView->CopyContentsToTexture(atlasTexture, m_atlasRect.offset.x, m_atlasRect.offset.y);
+    m_ulReleasedContentGeneration = ulContentGeneration;
+    m_bHasReleasedImage = true;
+
+    const float fContentScale = m_pWebView->GetContentRenderScale();
+    m_panelLayerQuad.subImage.imageRect.extent = {
+            .width = GetScaledExtent(m_atlasRect.extent.width, fContentScale),
+            .height = GetScaledExtent(m_atlasRect.extent.height, fContentScale),
+    };
+
+    return true;
+}
+
+void XrUIPanel::AcquireImage(XRQFrameSwapchainScheduler &swapchainScheduler) {
+    m_nAcquiredImage = -1;
+    if (m_pAtlas) {
+        return;
+    }
+
+#ifndef DEBUGPANEL
+    //read before copying, so a frame published while copying is picked up next time rather than missed
+    m_ulAcquiredContentGeneration = m_pWebView->GetContentGeneration();
+#else
+    //the debug fill never changes, it is a single generation drawn once the webview is up
+    m_ulAcquiredContentGeneration = m_pWebView->GetContentGeneration() > 0 ? 1 : 0;
+#endif
+    if (m_ulAcquiredContentGeneration == 0) {
+        return;
+    }
+
+    if (m_bHasReleasedImage && m_ulAcquiredContentGeneration == m_ulReleasedContentGeneration) {
+        //nothing changed, the compositor keeps showing the last released image
+        return;
+    }
+
+    m_nAcquiredImage = swapchainScheduler.Acquire(m_panelSwapchain, "panel");
+}
+
+XrCompositionLayerBaseHeader *XrUIPanel::RenderFrame(XRQContext &xrqContext, XRQFrameSwapchainScheduler &swapchainScheduler) {
+    if (m_pAtlas || m_nAcquiredImage < 0) {
+        return m_bHasReleasedImage ? (XrCompositionLayerBaseHeader *) &m_panelLayerQuad : nullptr;
+    }
+
+    //the scheduler releases the image together with all the others before the frame ends. one the compositor didn't
+    //hand back in time is carried over to the next frame instead, the content stays pending and the panel is left out
+    GLuint swapchainTexture = swapchainScheduler.WaitForImage(m_nAcquiredImage);
+    m_nAcquiredImage = -1;
+    if (swapchainTexture == 0) {
+        return nullptr;
+    }
 
 #ifndef DEBUGPANEL
-    m_pWebView->CopyContentsToTexture( swapchainTexture );
+    m_pWebView->CopyContentsToTexture(swapchainTexture);
+
+    //the content only fills the corner its render scale covers, the compositor stretches that over the quad
+    const float fContentScale = m_pWebView->GetContentRenderScale();
+    m_panelLayerQuad.subImage.imageRect.extent = {
+            .width = GetScaledExtent((int32_t) m_panelConfig.unTextureWidth, fContentScale),
+            .height = GetScaledExtent((int32_t) m_panelConfig.unTextureHeight, fContentScale),
+    };
 #else
     m_pWebView->CopyDebugContentsToTexture(swapchainTexture);
 #endif
+    m_ulReleasedContentGeneration = m_ulAcquiredContentGeneration;
+    m_bHasReleasedImage = true;
+
     return (XrCompositionLayerBaseHeader *) &m_panelLayerQuad;
 }
 
+void XrUIPanel::UpdateInput(const std::array<XrUIPanelHandInteractionState, 2> &handStates) {
+    m_aHandInteractionStates = handStates;
+
+    //a select that started off the panel doesn't press it when the ray moves onto it
+    std::array<bool, 2> abSelectPressed;
+    for (int i = 0; i < 2; i++) {
+        abSelectPressed[i] = handStates[i].bIsSelecting && !m_abLastSelecting[i];
+        m_abLastSelecting[i] = handStates[i].bIsSelecting;
+    }
+
+    if (m_bInputDisabled) {
+        if (m_bLastMouseState) {
+            m_pWebView->QueuePointerEvent(POINTER_ACTION_CANCEL, m_vecLastPointer.x, m_vecLastPointer.y);
+        } else if (m_bPointerHovering) {
+            m_pWebView->QueuePointerEvent(POINTER_ACTION_HOVER_EXIT, m_vecLastPointer.x, m_vecLastPointer.y);
+        }
+        m_bLastMouseState = false;
+        m_bPointerHovering = false;
+        m_nPointerHand = -1;
+
+        m_pWebView->FlushPointerEvents();
+        return;
+    }
+
+    if (!m_bLastMouseState && (m_nPointerHand < 0 || !handStates[m_nPointerHand].bRayIntersects)) {
+        m_nPointerHand = handStates[0].bRayIntersects ? 0 : (handStates[1].bRayIntersects ? 1 : -1);
+    }
+
+    if (m_nPointerHand < 0) {
+        if (m_bPointerHovering) {
+            m_pWebView->QueuePointerEvent(POINTER_ACTION_HOVER_EXIT, m_vecLastPointer.x, m_vecLastPointer.y);
+            m_bPointerHovering = false;
+        }
+
+        m_pWebView->FlushPointerEvents();
+        return;
+    }
+
+    //a press that leaves the panel keeps its last position on it until it is released
+    const XrUIPanelHandInteractionState &state = handStates[m_nPointerHand];
+    bool bMoved = false;
+    if (state.bRayIntersects) {
+        const XrVector2f vecPointer = {
+                .x = state.vecIntersection.x * (float) m_panelConfig.unTextureWidth,
+                .y = state.vecIntersection.y * (float) m_panelConfig.unTextureHeight,
+        };
+        bMoved = vecPointer.x != m_vecLastPointer.x || vecPointer.y != m_vecLastPointer.y;
+        m_vecLastPointer = vecPointer;
+    }
+
+    const float fX = m_vecLastPointer.x;
+    const float fY = m_vecLastPointer.y;
+    if (m_bLastMouseState) {
+        if (state.bIsSelecting) {
+            if (bMoved) {
+                m_pWebView->QueuePointerEvent(POINTER_ACTION_MOVE, fX, fY);
+            }
+        } else {
+            m_pWebView->QueuePointerEvent(POINTER_ACTION_UP, fX, fY);
+            m_bLastMouseState = false;
+        }
+    } else if (abSelectPressed[m_nPointerHand]) {
+        if (m_bPointerHovering) {
+            m_pWebView->QueuePointerEvent(POINTER_ACTION_HOVER_EXIT, fX, fY);
+            m_bPointerHovering = false;
+        }
+
+        m_pWebView->QueuePointerEvent(POINTER_ACTION_DOWN, fX, fY);
+        m_bLastMouseState = true;
+    } else if (!m_bPointerHovering) {
+        m_pWebView->QueuePointerEvent(POINTER_ACTION_HOVER_ENTER, fX, fY);
+        m_bPointerHovering = true;
+    } else if (bMoved) {
+        m_pWebView->QueuePointerEvent(POINTER_ACTION_HOVER_MOVE, fX, fY);
+    }
+
+    m_pWebView->FlushPointerEvents();
+}
+
 void XrUIPanel::UnFocused() {
     Log("[XRUIPanel] Panel was unfocused");
     m_pWebView->RequestPause();
@@ -202,5 +482,8 @@ const PanelConfig &XrUIPanel::GetPanelConfig() {
 
 XrUIPanel::~XrUIPanel() {
     Log("[XRUIPanel] destroying UI panel...");
+    if (m_pAtlas) {
+        XRQFreeSwapchainAtlasRect(*m_pAtlas, m_atlasRect);
+    }
     m_pWebView = nullptr;
 }
\ No newline at end of file
@@ -13,18 +13,26 @@ class IPanelPositioner
 public:
     virtual glm::mat4 GetMatrix( const glm::mat4 &matHmdPosition ) = 0;
 
+    //true if the panel is rigidly attached to the head, its layer is then submitted in VIEW space
+    virtual bool BIsHeadLocked() const { return false; }
+
     virtual ~IPanelPositioner() = default;
 };
 
 class PanelPositionerHUD : public IPanelPositioner
 {
 public:
-    PanelPositionerHUD( const glm::mat4 &matOffsetPosition );
+    //with bLockToView the compositor keeps the panel locked to the head, so it has no pose lag at all
+    PanelPositionerHUD( const glm::mat4 &matOffsetPosition, bool bLockToView = false );
 
     glm::mat4 GetMatrix( const glm::mat4 &matHmdPosition ) override;
 
+    bool BIsHeadLocked() const override { return m_bLockToView; }
+
 private:
     glm::mat4 m_matOffsetPosition{1.f};
+
+    bool m_bLockToView;
 };
 
 class PanelPositionerSlowTurnFromHead : public IPanelPositioner
@@ -63,6 +71,8 @@ private:
 struct XrUIPanelHandInteractionState
 {
 	bool bRayIntersects = false;
+
+	//0,0 is the top left of the page
 	XrVector2f vecIntersection{};
 	XrVector3f vecWorldIntersection{};
 	bool bIsSelecting = false;
@@ -75,17 +85,63 @@ public:
 			   std::shared_ptr<WebView> pWebView,
 			   std::unique_ptr<IPanelPositioner> pPanelPositioner );
 
-	bool Init( const XRQContext &xrqContext );
+	//with an atlas the panel draws into a rect of the atlas swapchain rather than a swapchain of its own
+	bool Init( const XRQContext &xrqContext, XRQSwapchainAtlas *pAtlas = nullptr );
+
+	bool BUsesAtlas() const { return m_pAtlas != nullptr; }
+
+	//true if the webview has published content the panel's image doesn't show yet
+	bool BHasNewContent() const;
+
+	//refreshes the panel's rect in the acquired atlas image, returns false if there is nothing to show yet
+	bool CopyToAtlas( GLuint atlasTexture );
 
 	void Focused();
 
+	//true once unFrameTimes frame times have passed since the last draw request
+	bool BIsDrawDue( uint64_t ulTimeNowUS, uint32_t unFrameTimes = 1 ) const;
+
+	void RequestDraw( uint64_t ulTimeNowUS );
+
+	uint64_t GetLastDrawRequestTimeUS() const { return m_ulLastRenderTimeUS; }
+
+	uint32_t GetFrameTimeUS() const { return m_ulPanelFrameTimeUS; }
+
+	//pose in the play space the panel was last positioned at, whatever space its layer is submitted in
+	const XrPosef &GetPose() const { return m_panelPose; }
+
+	//flushes messages to the page and positions the panel for this frame, call every frame even while culled
+	void Update( XRQContext &xrqContext );
+
+	//positions the panel again from a head pose located right before the frame ends, so the time spent
+	//copying content doesn't add to the pose latency. Panels with a VIEW space layer need nothing
+	void LateLatchPose( const XrPosef &headPose );
+
+	//true if the panel grown by fMarginDegrees on every side overlaps any of the current frame's views
+	bool BIsInView( const XRQContext &xrqContext, float fMarginDegrees ) const;
+
+	//picks the render scale from how many display pixels the panel covers. A fDetailScale below one settles for
+	//fewer pixels than the display could resolve, for panels the user isn't looking at
+	void UpdateRenderScale( const XRQContext &xrqContext, float fDetailScale = 1.f );
+
+	//acquires the panel's swapchain image ahead of RenderFrame if there is new content to copy into it
+	void AcquireImage( XRQFrameSwapchainScheduler &swapchainScheduler );
+
+	//copies new content into the image acquired by AcquireImage, returns nullptr if the panel has nothing to show yet.
+	//atlas panels only hand back their layer, their content is copied by whoever owns the atlas
 	XrCompositionLayerBaseHeader *
-	RenderFrame( XRQContext &xrqContext );
+	RenderFrame( XRQContext &xrqContext, XRQFrameSwapchainScheduler &swapchainScheduler );
 
 	void UnFocused();
 
 	const PanelConfig &GetPanelConfig();
 
+	//turns this frame's ray hits of both hands into pointer events for the webview. The hand that pressed keeps
+	//the pointer until it lets go, otherwise it follows whichever hand points at the panel
+	void UpdateInput( const std::array<XrUIPanelHandInteractionState, 2> &handStates );
+
+	const XrUIPanelHandInteractionState &GetHandInteractionState( XRQHand hand ) const { return m_aHandInteractionStates[ hand ]; }
+
 	void DisableInput() { m_bInputDisabled = true; }
 
 	void EnableInput() { m_bInputDisabled = false; }
@@ -95,16 +151,41 @@ public:
 	std::shared_ptr<WebView> m_pWebView;
 
 private:
+	void UpdatePose( const XrPosef &headPose );
+
 	std::unique_ptr<IPanelPositioner> m_pPanelPositioner;
 
 	XRQSwapchain m_panelSwapchain{};
+
+	XRQSwapchainAtlas *m_pAtlas = nullptr;
+	XrRect2Di m_atlasRect{};
 	XrCompositionLayerQuad m_panelLayerQuad{};
+	XrPosef m_panelPose{};
 
 	PanelConfig m_panelConfig;
 	uint32_t m_ulPanelFrameTimeUS = 16000;
 
 	uint64_t m_ulLastRenderTimeUS = 0;
 
+	//content generation of the webview when the panel swapchain image was last released
+	uint64_t m_ulReleasedContentGeneration = 0;
+	bool m_bHasReleasedImage = false;
+
+	//scheduler handle of this frame's acquired image, -1 if none
+	int32_t m_nAcquiredImage = -1;
+	uint64_t m_ulAcquiredContentGeneration = 0;
+
+	//index into the render scale levels, 0 is full resolution
+	uint32_t m_unRenderScaleLevel = 0;
+
+	std::array<XrUIPanelHandInteractionState, 2> m_aHandInteractionStates{};
+	std::array<bool, 2> m_abLastSelecting = {false, false};
+
+	//hand driving the webview's pointer, -1 if none
+	int32_t m_nPointerHand = -1;
+	bool m_bPointerHovering = false;
+	XrVector2f m_vecLastPointer{};
+
 	bool m_bLastMouseState = false;
 	bool m_bInputDisabled = false;
 };
\ No newline at end of file
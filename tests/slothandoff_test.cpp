@@ -0,0 +1,171 @@
+#include "slothandoff.h"
+#include "timeutils.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+//mirrors PixelBufferRing: 3 slots, the consumer keeps a slot in flight for a while after taking it, like the GPU
+//reading it behind a fence, and the producer keeps publishing as fast as it can
+static const uint32_t k_unSlots = 3;
+static const uint32_t k_unPayloadWords = 4096;
+static const uint64_t k_ulFrames = 200000;
+static const uint64_t k_ulAbortEvery = 97;
+static const uint32_t k_unInFlightPolls = 2;
+
+//the producer pauses briefly after each burst, so the consumer gets to run even on a single core
+static const uint64_t k_ulBurstFrames = 16;
+
+//generous, the point is catching frames that sit in a slot for good, not scheduler noise
+static const uint64_t k_ulMaxMedianHandoffUS = 20000;
+
+struct Slot
+{
+	std::array<uint64_t, k_unPayloadWords> aPayload;
+	uint64_t ulFrameId = 0;
+	uint64_t ulPublishTimeUS = 0;
+};
+
+static bool BIsPayloadIntact( const Slot &slot )
+{
+	return std::all_of( slot.aPayload.begin(), slot.aPayload.end(), [&slot]( uint64_t ulWord ) { return ulWord == slot.ulFrameId; } );
+}
+
+int main()
+{
+	SlotHandoff handoff( k_unSlots );
+	std::array<Slot, k_unSlots> aSlots = {};
+
+	//the consumer owns every slot at the start, like the unmapped buffers of the ring
+	for ( uint32_t i = 0; i < k_unSlots; i++ )
+	{
+		handoff.Release((int) i );
+	}
+
+	std::atomic<bool> bProducerDone = false;
+	uint64_t ulReclaimed = 0;
+	uint64_t ulAborted = 0;
+	uint64_t ulStalls = 0;
+
+	std::thread producer( [&]
+	{
+		for ( uint64_t ulFrameId = 1; ulFrameId <= k_ulFrames; ulFrameId++ )
+		{
+			bool bReclaimed = false;
+			int nSlot;
+			while (( nSlot = handoff.BeginWrite( bReclaimed )) < 0 )
+			{
+				ulStalls++;
+				std::this_thread::yield();
+			}
+			ulReclaimed += bReclaimed ? 1 : 0;
+
+			Slot &slot = aSlots[ nSlot ];
+			slot.ulFrameId = ulFrameId;
+			slot.aPayload.fill( ulFrameId );
+
+			//the last frame always goes out, so the consumer has to end up on it
+			if ( ulFrameId % k_ulAbortEvery == 0 && ulFrameId != k_ulFrames )
+			{
+				ulAborted++;
+				handoff.AbortWrite( nSlot );
+				continue;
+			}
+
+			slot.ulPublishTimeUS = GetCurrentTimeUS();
+			handoff.EndWrite( nSlot );
+
+			if ( ulFrameId % k_ulBurstFrames == 0 )
+			{
+				std::this_thread::sleep_for( std::chrono::microseconds( 50 ));
+			}
+		}
+
+		bProducerDone.store( true, std::memory_order_release );
+	} );
+
+	uint64_t ulConsumed = 0;
+	uint64_t ulTorn = 0;
+	uint64_t ulOutOfOrder = 0;
+	uint64_t ulLastFrameId = 0;
+	std::vector<uint64_t> vHandoffLatenciesUS;
+	vHandoffLatenciesUS.reserve( k_ulFrames );
+
+	int nInFlightSlot = -1;
+	uint32_t unInFlightPolls = 0;
+
+	for ( ;; )
+	{
+		//read before acquiring, so a frame published right before the producer finished is still picked up
+		const bool bDone = bProducerDone.load( std::memory_order_acquire );
+
+		if ( nInFlightSlot >= 0 && ++unInFlightPolls >= k_unInFlightPolls )
+		{
+			//the producer must not have touched the slot while it was in flight
+			ulTorn += BIsPayloadIntact( aSlots[ nInFlightSlot ] ) ? 0 : 1;
+			handoff.Release( nInFlightSlot );
+			nInFlightSlot = -1;
+		}
+
+		const int nSlot = handoff.Acquire();
+		if ( nSlot < 0 )
+		{
+			if ( bDone )
+			{
+				break;
+			}
+
+			std::this_thread::yield();
+			continue;
+		}
+
+		const Slot &slot = aSlots[ nSlot ];
+		vHandoffLatenciesUS.push_back( GetCurrentTimeUS() - slot.ulPublishTimeUS );
+		ulTorn += BIsPayloadIntact( slot ) ? 0 : 1;
+		ulOutOfOrder += slot.ulFrameId > ulLastFrameId ? 0 : 1;
+		ulLastFrameId = slot.ulFrameId;
+		ulConsumed++;
+
+		//only one slot is ever ready, so nothing can be in flight twice
+		if ( nInFlightSlot >= 0 )
+		{
+			handoff.Release( nInFlightSlot );
+		}
+		nInFlightSlot = nSlot;
+		unInFlightPolls = 0;
+	}
+
+	producer.join();
+
+	std::sort( vHandoffLatenciesUS.begin(), vHandoffLatenciesUS.end());
+	const uint64_t ulMedianUS = vHandoffLatenciesUS.empty() ? 0 : vHandoffLatenciesUS[ vHandoffLatenciesUS.size() / 2 ];
+	const uint64_t ulMaxUS = vHandoffLatenciesUS.empty() ? 0 : vHandoffLatenciesUS.back();
+
+	printf( "consumed %" PRIu64 ", reclaimed %" PRIu64 ", aborted %" PRIu64 ", producer stalls %" PRIu64 "\n",
+			ulConsumed, ulReclaimed, ulAborted, ulStalls );
+	printf( "handoff latency median %" PRIu64 " us, max %" PRIu64 " us\n", ulMedianUS, ulMaxUS );
+
+	int nFailures = 0;
+	auto Expect = [&nFailures]( bool bCondition, const char *pchWhat )
+	{
+		if ( !bCondition )
+		{
+			printf( "FAILED: %s\n", pchWhat );
+			nFailures++;
+		}
+	};
+
+	Expect( ulTorn == 0, "no frame is modified while the consumer owns it" );
+	Expect( ulOutOfOrder == 0, "frames are picked up in publish order" );
+	Expect( ulLastFrameId == k_ulFrames, "the newest frame is always handed over" );
+	Expect( ulConsumed + ulReclaimed + ulAborted == k_ulFrames, "every frame is either consumed, superseded or aborted" );
+	Expect( ulConsumed >= k_ulFrames / k_ulBurstFrames / 2, "frames get through while the producer is busy" );
+	Expect( ulMedianUS <= k_ulMaxMedianHandoffUS, "frames are picked up promptly" );
+
+	return nFailures == 0 ? 0 : 1;
+}
\ No newline at end of file